@@ -0,0 +1,739 @@
+#include <math.h>
+#include <string.h>
+
+#include "apu.h"
+#include "memory.h"
+#include "system.h"
+#include "state.h"
+#include "stats.h"
+
+CONSOLE_LOCAL struct APU 	apu;
+CONSOLE_LOCAL struct APU_Buffer*	apu_buffer;
+
+static const uint8_t lut_length[32] = {
+	10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+	12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t lut_duty[4][8] = {
+	{ 0, 1, 0, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 0, 0, 0, 0, 0 },
+	{ 0, 1, 1, 1, 1, 0, 0, 0 },
+	{ 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+static const uint8_t lut_triangle[32] = {
+	15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+	 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15
+};
+
+// in CPU cycles, by TV system; the Dendy's APU keeps the NTSC tables
+static const uint16_t lut_noise[3][16] = {
+	[NTSC] 	= { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 },
+	[PAL] 	= { 4, 8, 14, 30, 60, 88, 118, 148, 188, 236, 354, 472, 708, 944, 1890, 3778 },
+	[Dendy] = { 4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068 }
+};
+
+static const uint16_t lut_dmc[3][16] = {
+	[NTSC] 	= { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 },
+	[PAL] 	= { 398, 354, 316, 298, 276, 236, 210, 198, 176, 148, 132, 118, 98, 78, 66, 50 },
+	[Dendy] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 }
+};
+
+// frame sequencer steps, in CPU cycles since the last $4017 write
+static const uint16_t lut_sequencer[3][2][5] = {
+	[NTSC] = {
+		{ 7457, 14913, 22371, 29829, 29830 },
+		{ 7457, 14913, 22371, 29829, 37282 }
+	},
+	[PAL] = {
+		{ 8313, 16627, 24939, 33252, 33253 },
+		{ 8313, 16627, 24939, 33252, 41565 }
+	},
+	[Dendy] = {
+		{ 7457, 14913, 22371, 29829, 29830 },
+		{ 7457, 14913, 22371, 29829, 37282 }
+	}
+};
+
+// linear approximation of the mixer, scaled to 16 bits
+#define GAIN_PULSE 	(0.00752f * 32000)
+#define GAIN_TRIANGLE 	(0.00851f * 32000)
+#define GAIN_NOISE 	(0.00494f * 32000)
+#define GAIN_DMC 	(0.00335f * 32000)
+
+#define HIGHPASS 	0.996f
+
+// Windowed-sinc impulse per sub-sample phase. The buffer holds the derivative
+// of the output, so one impulse per level change is a band-limited step once
+// integrated. Shared by every console, filled before main() runs.
+static float blip_kernel[BLIP_PHASES][BLIP_TAPS];
+
+__attribute__((constructor)) static void blip_init()
+{
+	const double cutoff = 0.90;
+
+	for (int p = 0; p < BLIP_PHASES; p++)
+	{
+		double sum = 0;
+
+		for (int k = 0; k < BLIP_TAPS; k++)
+		{
+			double x = k - (BLIP_TAPS / 2 - 1) - (double)p / BLIP_PHASES;
+			double t = M_PI * cutoff * x;
+			double sinc = x == 0 ? 1.0 : sin(t) / t;
+			double w = (x + BLIP_TAPS / 2) / BLIP_TAPS;
+			double window = 0.42 - 0.5 * cos(2 * M_PI * w) + 0.08 * cos(4 * M_PI * w);
+
+			blip_kernel[p][k] = sinc * window;
+			sum += blip_kernel[p][k];
+		}
+
+		for (int k = 0; k < BLIP_TAPS; k++)
+			blip_kernel[p][k] /= sum;
+	}
+}
+
+static void blip_add(uint64_t time, float delta)
+{
+	uint64_t position = (time - apu.blip_origin) * apu.blip_factor + apu.blip_fraction;
+	size_t index = position >> 32;
+
+	// nobody drained the buffer; drop rather than overrun it
+	if (index >= BLIP_SIZE)
+		return;
+
+	const float* kernel = blip_kernel[(position >> (32 - 5)) & (BLIP_PHASES - 1)];
+	float* out = apu_buffer->deltas + index;
+
+	for (int k = 0; k < BLIP_TAPS; k++)
+		out[k] += delta * kernel[k];
+}
+
+// Envelope, sweep and counter units
+
+static inline uint8_t envelope_volume(bool constant, uint8_t volume, uint8_t decay)
+{
+	return constant ? volume : decay;
+}
+
+static inline void clock_envelope(bool* start, uint8_t* divider, uint8_t* decay, uint8_t volume, bool loop)
+{
+	if (*start)
+	{
+		*start = false;
+		*decay = 15;
+		*divider = volume;
+	}
+	else if (*divider == 0)
+	{
+		*divider = volume;
+
+		if (*decay > 0)
+			(*decay)--;
+		else if (loop)
+			*decay = 15;
+	}
+	else
+		(*divider)--;
+}
+
+static inline uint16_t sweep_target(const struct Pulse* p, int channel)
+{
+	uint16_t change = p->timer_period >> p->sweep_shift;
+
+	if (!p->sweep_negate)
+		return p->timer_period + change;
+
+	// pulse 1 negates in ones' complement
+	change += (channel == 0);
+	return change > p->timer_period ? 0 : p->timer_period - change;
+}
+
+static inline bool pulse_muted(const struct Pulse* p, int channel)
+{
+	return p->timer_period < 8 || sweep_target(p, channel) > 0x7FF;
+}
+
+// Channel outputs. Each returns the DAC level the channel would produce now.
+
+static inline int8_t pulse_level(const struct Pulse* p, int channel)
+{
+	if (p->length == 0 || pulse_muted(p, channel) || !lut_duty[p->duty][p->step])
+		return 0;
+
+	return envelope_volume(p->constant, p->volume, p->envelope_decay);
+}
+
+static inline int8_t triangle_level(const struct Triangle* t)
+{
+	return lut_triangle[t->step];
+}
+
+static inline int8_t noise_level(const struct Noise* n)
+{
+	if (n->length == 0 || (n->shift & 1))
+		return 0;
+
+	return envelope_volume(n->constant, n->volume, n->envelope_decay);
+}
+
+static inline void update_pulse(int channel, uint64_t time)
+{
+	struct Pulse* p = &apu.pulse[channel];
+	int8_t level = pulse_level(p, channel);
+
+	if (level != p->output)
+	{
+		blip_add(time, (level - p->output) * GAIN_PULSE);
+		p->output = level;
+	}
+}
+
+static inline void update_triangle(uint64_t time)
+{
+	struct Triangle* t = &apu.triangle;
+	int8_t level = triangle_level(t);
+
+	if (level != t->output)
+	{
+		blip_add(time, (level - t->output) * GAIN_TRIANGLE);
+		t->output = level;
+	}
+}
+
+static inline void update_noise(uint64_t time)
+{
+	struct Noise* n = &apu.noise;
+	int8_t level = noise_level(n);
+
+	if (level != n->output)
+	{
+		blip_add(time, (level - n->output) * GAIN_NOISE);
+		n->output = level;
+	}
+}
+
+static inline void set_dmc_output(int8_t level, uint64_t time)
+{
+	if (level != apu.dmc.output)
+	{
+		blip_add(time, (level - apu.dmc.output) * GAIN_DMC);
+		apu.dmc.output = level;
+	}
+}
+
+// Timers. Each runs its channel from next_clock up to (not including) end,
+// only touching the buffer when the level actually changes.
+
+static void run_pulse(int channel, uint64_t end)
+{
+	struct Pulse* p = &apu.pulse[channel];
+	uint32_t period = ((uint32_t)p->timer_period + 1) * 2;
+
+	if (p->next_clock >= end)
+		return;
+
+	// silent: the sequencer still moves but nothing can be heard
+	if (p->length == 0 || pulse_muted(p, channel))
+	{
+		uint64_t count = (end - p->next_clock + period - 1) / period;
+		p->step = (p->step + count) & 7;
+		p->next_clock += count * period;
+		return;
+	}
+
+	for (; p->next_clock < end; p->next_clock += period)
+	{
+		p->step = (p->step + 1) & 7;
+		update_pulse(channel, p->next_clock);
+	}
+}
+
+static void run_triangle(uint64_t end)
+{
+	struct Triangle* t = &apu.triangle;
+	uint32_t period = (uint32_t)t->timer_period + 1;
+
+	if (t->next_clock >= end)
+		return;
+
+	// halted, or ultrasonic and better left alone than aliased
+	if (t->length == 0 || t->linear == 0 || t->timer_period < 2)
+	{
+		t->next_clock += (end - t->next_clock + period - 1) / period * period;
+		return;
+	}
+
+	for (; t->next_clock < end; t->next_clock += period)
+	{
+		t->step = (t->step + 1) & 31;
+		update_triangle(t->next_clock);
+	}
+}
+
+static void run_noise(uint64_t end)
+{
+	struct Noise* n = &apu.noise;
+	uint32_t period = n->timer_period;
+
+	for (; n->next_clock < end; n->next_clock += period)
+	{
+		uint16_t feedback = (n->shift ^ (n->shift >> (n->mode ? 6 : 1))) & 1;
+		n->shift = (n->shift >> 1) | (feedback << 14);
+
+		update_noise(n->next_clock);
+	}
+}
+
+static void dmc_fetch()
+{
+	struct DMC* d = &apu.dmc;
+
+	// samples always live in $C000-$FFFF, i.e. PRG ROM, so fetching late is safe
+	d->buffer = prg_memory[d->address & 0x7FFF];
+	d->buffer_full = true;
+	d->address = d->address == 0xFFFF ? 0x8000 : d->address + 1;
+
+	if (--d->remaining == 0)
+	{
+		if (d->loop)
+		{
+			d->address = d->sample_address;
+			d->remaining = d->sample_length;
+		}
+		else if (d->irq_enabled)
+			apu.dmc_irq = true;
+	}
+}
+
+static void run_dmc(uint64_t end)
+{
+	struct DMC* d = &apu.dmc;
+
+	for (; d->next_clock < end; d->next_clock += d->timer_period)
+	{
+		if (!d->silence)
+		{
+			if (d->shift & 1)
+			{
+				if (d->output <= 125)
+					set_dmc_output(d->output + 2, d->next_clock);
+			}
+			else if (d->output >= 2)
+				set_dmc_output(d->output - 2, d->next_clock);
+		}
+
+		d->shift >>= 1;
+
+		if (--d->bits == 0)
+		{
+			d->bits = 8;
+			d->silence = !d->buffer_full;
+
+			if (d->buffer_full)
+			{
+				d->shift = d->buffer;
+				d->buffer_full = false;
+			}
+
+			if (d->remaining > 0)
+				dmc_fetch();
+		}
+	}
+}
+
+// Frame sequencer
+
+static void clock_quarter()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		struct Pulse* p = &apu.pulse[i];
+		clock_envelope(&p->envelope_start, &p->envelope_divider, &p->envelope_decay, p->volume, p->halt);
+	}
+
+	struct Noise* n = &apu.noise;
+	clock_envelope(&n->envelope_start, &n->envelope_divider, &n->envelope_decay, n->volume, n->halt);
+
+	struct Triangle* t = &apu.triangle;
+
+	if (t->linear_start)
+		t->linear = t->linear_reload;
+	else if (t->linear > 0)
+		t->linear--;
+
+	if (!t->control)
+		t->linear_start = false;
+}
+
+static void clock_half()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		struct Pulse* p = &apu.pulse[i];
+
+		if (!p->halt && p->length > 0)
+			p->length--;
+
+		if (p->sweep_divider == 0 && p->sweep_enabled && p->sweep_shift > 0 && !pulse_muted(p, i))
+			p->timer_period = sweep_target(p, i);
+
+		if (p->sweep_divider == 0 || p->sweep_reload)
+		{
+			p->sweep_divider = p->sweep_period;
+			p->sweep_reload = false;
+		}
+		else
+			p->sweep_divider--;
+	}
+
+	if (!apu.triangle.control && apu.triangle.length > 0)
+		apu.triangle.length--;
+
+	if (!apu.noise.halt && apu.noise.length > 0)
+		apu.noise.length--;
+}
+
+static void update_outputs(uint64_t time)
+{
+	update_pulse(0, time);
+	update_pulse(1, time);
+	update_triangle(time);
+	update_noise(time);
+}
+
+static void clock_sequencer()
+{
+	const uint16_t* steps = lut_sequencer[tv_system][apu.five_step];
+	uint8_t step = apu.frame_step;
+
+	if (apu.five_step)
+	{
+		if (step != 3)
+			clock_quarter();
+		if (step == 1 || step == 4)
+			clock_half();
+	}
+	else
+	{
+		if (step < 4)
+			clock_quarter();
+		if (step == 1 || step == 3)
+			clock_half();
+		if (step >= 3 && !apu.irq_inhibit)
+			apu.frame_irq = true;
+	}
+
+	update_outputs(apu.frame_next);
+
+	if (step == 4)
+	{
+		apu.frame_step = 0;
+		apu.frame_next += steps[0];
+	}
+	else
+	{
+		apu.frame_step++;
+		apu.frame_next += steps[step + 1] - steps[step];
+	}
+}
+
+// The next cycle at which the IRQ line might rise. Until then nobody can
+// observe the APU and it is left to fall behind.
+static void schedule()
+{
+	apu.next_event = UINT64_MAX;
+
+	if (!apu.five_step && !apu.irq_inhibit && !apu.frame_irq)
+		apu.next_event = apu.frame_next;
+
+	if (apu.dmc.irq_enabled && !apu.dmc_irq && apu.dmc.remaining > 0 && apu.dmc.next_clock < apu.next_event)
+		apu.next_event = apu.dmc.next_clock + 1;
+}
+
+void apu_run(uint64_t until)
+{
+	STAT_TIMER_START(start);
+
+	while (apu.time < until)
+	{
+		uint64_t end = apu.frame_next < until ? apu.frame_next : until;
+
+		run_pulse(0, end);
+		run_pulse(1, end);
+		run_triangle(end);
+		run_noise(end);
+		run_dmc(end);
+
+		apu.time = end;
+
+		if (end == apu.frame_next)
+			clock_sequencer();
+	}
+
+	schedule();
+
+	STAT_TIMER_STOP(start, Timer_APU);
+}
+
+void apu_end_frame()
+{
+	apu_run(cpu_cycle_count);
+
+	STAT_TIMER_START(start);
+
+	uint64_t position = (apu.time - apu.blip_origin) * apu.blip_factor + apu.blip_fraction;
+	size_t count = position >> 32;
+
+	// left to run for longer than the buffer holds; start over from silence
+	if (count > BLIP_SIZE)
+	{
+		count = BLIP_SIZE;
+		position = (uint64_t)count << 32;
+	}
+
+	struct APU_Buffer* b = apu_buffer;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		b->integrator += b->deltas[i];
+
+		// the console's own output is AC coupled
+		float out = b->integrator - b->highpass_in + HIGHPASS * b->highpass_out;
+		b->highpass_in = b->integrator;
+		b->highpass_out = out;
+
+		if (out > 32767)
+			out = 32767;
+		else if (out < -32768)
+			out = -32768;
+
+		b->samples[i] = (int16_t)out;
+	}
+
+	b->sample_count = count;
+
+	// the tail still receives the leading half of future steps
+	memmove(b->deltas, b->deltas + count, BLIP_TAPS * sizeof(float));
+	memset(b->deltas + BLIP_TAPS, 0, count * sizeof(float));
+
+	apu.blip_origin = apu.time;
+	apu.blip_fraction = position - ((uint64_t)count << 32);
+
+	STAT_TIMER_STOP(start, Timer_APU);
+}
+
+void apu_reset()
+{
+	memset(&apu, 0, sizeof(apu));
+
+	apu.noise.shift = 1;
+	apu.noise.timer_period = lut_noise[tv_system][0];
+	apu.dmc.timer_period = lut_dmc[tv_system][0];
+	apu.dmc.bits = 8;
+	apu.dmc.silence = true;
+
+	apu.time = cpu_cycle_count;
+	apu.pulse[0].next_clock = apu.time;
+	apu.pulse[1].next_clock = apu.time;
+	apu.triangle.next_clock = apu.time;
+	apu.noise.next_clock = apu.time;
+	apu.dmc.next_clock = apu.time;
+	apu.frame_next = apu.time + lut_sequencer[tv_system][0][0];
+
+	apu.blip_origin = apu.time;
+	apu.blip_factor = ((uint64_t)APU_SAMPLE_RATE << 32) / tv_timings[tv_system].cpu_rate;
+
+	memset(apu_buffer, 0, sizeof(struct APU_Buffer));
+
+	schedule();
+}
+
+void apu_write(uint16_t address, uint8_t data)
+{
+	apu_run(cpu_cycle_count);
+
+	uint64_t now = apu.time;
+
+	switch (address)
+	{
+		case (0x4000):
+		case (0x4004): // pulse duty, envelope
+		{
+			struct Pulse* p = &apu.pulse[(address >> 2) & 1];
+			p->duty = data >> 6;
+			p->halt = data & 0x20;
+			p->constant = data & 0x10;
+			p->volume = data & 0x0F;
+			break;
+		}
+		case (0x4001):
+		case (0x4005): // pulse sweep
+		{
+			struct Pulse* p = &apu.pulse[(address >> 2) & 1];
+			p->sweep_enabled = data & 0x80;
+			p->sweep_period = (data >> 4) & 0x07;
+			p->sweep_negate = data & 0x08;
+			p->sweep_shift = data & 0x07;
+			p->sweep_reload = true;
+			break;
+		}
+		case (0x4002):
+		case (0x4006): // pulse timer low
+		{
+			struct Pulse* p = &apu.pulse[(address >> 2) & 1];
+			p->timer_period = (p->timer_period & 0x0700) | data;
+			break;
+		}
+		case (0x4003):
+		case (0x4007): // pulse length, timer high
+		{
+			struct Pulse* p = &apu.pulse[(address >> 2) & 1];
+			p->timer_period = (p->timer_period & 0x00FF) | ((uint16_t)(data & 0x07) << 8);
+			if (p->enabled)
+				p->length = lut_length[data >> 3];
+			p->step = 0;
+			p->envelope_start = true;
+			break;
+		}
+		case (0x4008): // triangle linear counter
+			apu.triangle.control = data & 0x80;
+			apu.triangle.linear_reload = data & 0x7F;
+			break;
+		case (0x400A): // triangle timer low
+			apu.triangle.timer_period = (apu.triangle.timer_period & 0x0700) | data;
+			break;
+		case (0x400B): // triangle length, timer high
+			apu.triangle.timer_period = (apu.triangle.timer_period & 0x00FF) | ((uint16_t)(data & 0x07) << 8);
+			if (apu.triangle.enabled)
+				apu.triangle.length = lut_length[data >> 3];
+			apu.triangle.linear_start = true;
+			break;
+		case (0x400C): // noise envelope
+			apu.noise.halt = data & 0x20;
+			apu.noise.constant = data & 0x10;
+			apu.noise.volume = data & 0x0F;
+			break;
+		case (0x400E): // noise mode, period
+			apu.noise.mode = data & 0x80;
+			apu.noise.timer_period = lut_noise[tv_system][data & 0x0F];
+			break;
+		case (0x400F): // noise length
+			if (apu.noise.enabled)
+				apu.noise.length = lut_length[data >> 3];
+			apu.noise.envelope_start = true;
+			break;
+		case (0x4010): // dmc flags, rate
+			apu.dmc.irq_enabled = data & 0x80;
+			apu.dmc.loop = data & 0x40;
+			apu.dmc.timer_period = lut_dmc[tv_system][data & 0x0F];
+			if (!apu.dmc.irq_enabled)
+				apu.dmc_irq = false;
+			break;
+		case (0x4011): // dmc direct load
+			set_dmc_output(data & 0x7F, now);
+			break;
+		case (0x4012): // dmc sample address
+			apu.dmc.sample_address = 0xC000 | ((uint16_t)data << 6);
+			break;
+		case (0x4013): // dmc sample length
+			apu.dmc.sample_length = ((uint16_t)data << 4) + 1;
+			break;
+		case (0x4015): // channel enable
+			apu.pulse[0].enabled = data & 0x01;
+			apu.pulse[1].enabled = data & 0x02;
+			apu.triangle.enabled = data & 0x04;
+			apu.noise.enabled = data & 0x08;
+
+			if (!apu.pulse[0].enabled)
+				apu.pulse[0].length = 0;
+			if (!apu.pulse[1].enabled)
+				apu.pulse[1].length = 0;
+			if (!apu.triangle.enabled)
+				apu.triangle.length = 0;
+			if (!apu.noise.enabled)
+				apu.noise.length = 0;
+
+			apu.dmc_irq = false;
+
+			if (!(data & 0x10))
+				apu.dmc.remaining = 0;
+			else if (apu.dmc.remaining == 0)
+			{
+				apu.dmc.address = apu.dmc.sample_address;
+				apu.dmc.remaining = apu.dmc.sample_length;
+
+				if (!apu.dmc.buffer_full)
+					dmc_fetch();
+			}
+			break;
+		case (0x4017): // frame counter
+			apu.five_step = data & 0x80;
+			apu.irq_inhibit = data & 0x40;
+			if (apu.irq_inhibit)
+				apu.frame_irq = false;
+
+			apu.frame_step = 0;
+			apu.frame_next = now + lut_sequencer[tv_system][apu.five_step][0];
+
+			// five step mode clocks everything straight away
+			if (apu.five_step)
+			{
+				clock_quarter();
+				clock_half();
+			}
+			break;
+	}
+
+	update_outputs(now);
+	schedule();
+}
+
+uint8_t apu_read_status()
+{
+	apu_run(cpu_cycle_count);
+
+	uint8_t data = 0x00;
+
+	data |= (apu.pulse[0].length > 0) << 0;
+	data |= (apu.pulse[1].length > 0) << 1;
+	data |= (apu.triangle.length > 0) << 2;
+	data |= (apu.noise.length > 0) << 3;
+	data |= (apu.dmc.remaining > 0) << 4;
+	data |= apu.frame_irq << 6;
+	data |= apu.dmc_irq << 7;
+
+	apu.frame_irq = false;
+	schedule();
+
+	return data;
+}
+
+// Level of the IRQ line. Cheap enough for every cycle: the APU is only
+// brought up to date once the next possible edge has been reached.
+bool apu_irq()
+{
+	if (cpu_cycle_count >= apu.next_event)
+		apu_run(cpu_cycle_count);
+
+	return apu.frame_irq || apu.dmc_irq;
+}
+
+size_t apu_save_state(uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	SAVE_STATE(buffer, offset, apu);
+
+	return offset;
+}
+
+size_t apu_load_state(const uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	LOAD_STATE(buffer, offset, apu);
+
+	return offset;
+}
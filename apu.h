@@ -0,0 +1,144 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "console.h"
+
+#define APU_SAMPLE_RATE 	44100
+
+#define BLIP_PHASES 		32
+#define BLIP_TAPS 		16
+#define BLIP_SIZE 		4096	// samples; several frames' worth
+
+struct Pulse
+{
+	bool		enabled;
+	uint8_t		duty;
+	uint8_t		step;
+	bool		halt;		// also the envelope loop flag
+	bool		constant;
+	uint8_t		volume;
+
+	bool		envelope_start;
+	uint8_t		envelope_divider;
+	uint8_t		envelope_decay;
+
+	bool		sweep_enabled;
+	bool		sweep_negate;
+	bool		sweep_reload;
+	uint8_t		sweep_period;
+	uint8_t		sweep_divider;
+	uint8_t		sweep_shift;
+
+	uint16_t	timer_period;
+	uint8_t		length;
+
+	uint64_t	next_clock;
+	int8_t		output;
+};
+
+struct Triangle
+{
+	bool		enabled;
+	bool		control;	// also the length counter halt flag
+	uint8_t		linear_reload;
+	uint8_t		linear;
+	bool		linear_start;
+
+	uint16_t	timer_period;
+	uint8_t		length;
+	uint8_t		step;
+
+	uint64_t	next_clock;
+	int8_t		output;
+};
+
+struct Noise
+{
+	bool		enabled;
+	bool		halt;
+	bool		constant;
+	uint8_t		volume;
+	bool		mode;
+
+	bool		envelope_start;
+	uint8_t		envelope_divider;
+	uint8_t		envelope_decay;
+
+	uint16_t	timer_period;
+	uint16_t	shift;
+	uint8_t		length;
+
+	uint64_t	next_clock;
+	int8_t		output;
+};
+
+struct DMC
+{
+	bool		irq_enabled;
+	bool		loop;
+	uint16_t	timer_period;
+
+	uint16_t	sample_address;
+	uint16_t	sample_length;
+	uint16_t	address;
+	uint16_t	remaining;
+
+	uint8_t		buffer;
+	bool		buffer_full;
+	uint8_t		shift;
+	uint8_t		bits;
+	bool		silence;
+
+	uint64_t	next_clock;
+	int8_t		output;		// 0-127
+};
+
+struct APU
+{
+	struct Pulse 	pulse[2];
+	struct Triangle triangle;
+	struct Noise 	noise;
+	struct DMC 	dmc;
+
+	bool		five_step;
+	bool		irq_inhibit;
+	bool		frame_irq;
+	bool		dmc_irq;
+	uint8_t		frame_step;
+	uint64_t	frame_next;	// cycle of the next sequencer step
+
+	uint64_t	time;		// cycle the channels have been run up to
+	uint64_t	next_event;	// earliest cycle the IRQ line could change
+
+	uint64_t	blip_origin;	// cycle at sample position blip_fraction
+	uint64_t	blip_fraction;	// 32.32 sample position of blip_origin
+	uint64_t	blip_factor;	// 32.32 samples per cycle
+};
+
+// Band-limited step buffer plus the samples produced for the last frame.
+// Lives on the heap with the other per-console blocks.
+struct APU_Buffer
+{
+	float		deltas[BLIP_SIZE + BLIP_TAPS];
+	float		integrator;
+	float		highpass_in;
+	float		highpass_out;
+
+	int16_t		samples[BLIP_SIZE];
+	size_t		sample_count;
+};
+
+extern CONSOLE_LOCAL struct APU 	apu;
+extern CONSOLE_LOCAL struct APU_Buffer*	apu_buffer;
+
+void 		apu_reset();
+void 		apu_run(uint64_t until);
+void 		apu_end_frame();
+
+void 		apu_write(uint16_t address, uint8_t data);
+uint8_t 	apu_read_status();
+bool 		apu_irq();
+
+size_t 		apu_save_state(uint8_t* buffer);
+size_t 		apu_load_state(const uint8_t* buffer);
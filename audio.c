@@ -0,0 +1,65 @@
+#include <stdatomic.h>
+#include <SDL2/SDL.h>
+
+#include "audio.h"
+#include "apu.h"
+
+// Single producer (the emulation loop), single consumer (SDL's audio thread).
+// Each side only ever stores its own index, so no lock is needed.
+static int16_t 		ring[AUDIO_RING_SIZE];
+static atomic_size_t 	ring_read;
+static atomic_size_t 	ring_write;
+static int16_t 		last_sample;
+
+static void audio_callback(void* userdata, Uint8* stream, int length)
+{
+	int16_t* out = (int16_t*)stream;
+	size_t count = length / sizeof(int16_t);
+
+	size_t read = atomic_load_explicit(&ring_read, memory_order_relaxed);
+	size_t write = atomic_load_explicit(&ring_write, memory_order_acquire);
+
+	for (size_t i = 0; i < count; i++)
+	{
+		// underrun: hold the last level rather than click to zero
+		if (read != write)
+			last_sample = ring[read++ & (AUDIO_RING_SIZE - 1)];
+
+		out[i] = last_sample;
+	}
+
+	atomic_store_explicit(&ring_read, read, memory_order_release);
+}
+
+void audio_init()
+{
+	SDL_InitSubSystem(SDL_INIT_AUDIO);
+
+	SDL_AudioSpec spec = { 0 };
+	spec.freq = APU_SAMPLE_RATE;
+	spec.format = AUDIO_S16SYS;
+	spec.channels = 1;
+	spec.samples = 1024;
+	spec.callback = audio_callback;
+
+	SDL_AudioDeviceID device = SDL_OpenAudioDevice(NULL, 0, &spec, NULL, 0);
+
+	if (device != 0)
+		SDL_PauseAudioDevice(device, 0);
+}
+
+// Drops whatever does not fit; the video side sets the pace.
+void audio_queue(const int16_t* samples, size_t count)
+{
+	size_t write = atomic_load_explicit(&ring_write, memory_order_relaxed);
+	size_t read = atomic_load_explicit(&ring_read, memory_order_acquire);
+	size_t space = AUDIO_RING_SIZE - (write - read);
+
+	if (count > space)
+		count = space;
+
+	for (size_t i = 0; i < count; i++)
+		ring[write++ & (AUDIO_RING_SIZE - 1)] = samples[i];
+
+	atomic_store_explicit(&ring_write, write, memory_order_release);
+}
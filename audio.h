@@ -0,0 +1,7 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#define AUDIO_RING_SIZE 8192	// samples, power of two
+
+void 	audio_init();
+void 	audio_queue(const int16_t* samples, size_t count);
@@ -0,0 +1,227 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "nes.h"
+#include "console.h"
+
+struct NES_Worker
+{
+	struct NES_Batch*	batch;
+	pthread_t 		thread;
+	int 			first;
+	int 			last;
+};
+
+struct NES_Batch
+{
+	nes_t**			consoles;
+	int 			count;
+
+	struct NES_Worker*	workers;
+	int 			threads;
+
+	pthread_mutex_t 	lock;		// held while the workers are started
+	pthread_barrier_t 	start;
+	pthread_barrier_t 	done;
+
+	const uint8_t*		inputs;
+	int 			quit;
+};
+
+// Consoles are handed out in contiguous slices, so each one is only ever
+// live in a single thread's globals.
+static void step_slice(struct NES_Worker* worker)
+{
+	struct NES_Batch* batch = worker->batch;
+
+	for (int i = worker->first; i < worker->last; i++)
+	{
+		if (batch->inputs != NULL)
+		{
+			for (uint8_t port = 0; port < NES_PORTS; port++)
+				nes_set_input(batch->consoles[i], port, batch->inputs[i * NES_PORTS + port]);
+		}
+
+		nes_step_frame(batch->consoles[i]);
+	}
+
+	nes_detach();
+}
+
+static void* worker_main(void* argument)
+{
+	struct NES_Worker* worker = argument;
+
+	// wait for the barriers, or to be told the batch is off because
+	// another worker could not be started
+	pthread_mutex_lock(&worker->batch->lock);
+	pthread_mutex_unlock(&worker->batch->lock);
+
+	if (worker->batch->quit)
+		return NULL;
+
+	for (;;)
+	{
+		pthread_barrier_wait(&worker->batch->start);
+
+		if (worker->batch->quit)
+			break;
+
+		step_slice(worker);
+
+		pthread_barrier_wait(&worker->batch->done);
+	}
+
+	return NULL;
+}
+
+nes_batch_t* nes_batch_create(const char* filename, int count, int threads)
+{
+	if (count < 1)
+		return NULL;
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > count)
+		threads = count;
+
+	struct NES_Batch* batch = calloc(1, sizeof(struct NES_Batch));
+
+	if (batch == NULL)
+		return NULL;
+
+	batch->consoles = calloc(count, sizeof(nes_t*));
+	batch->workers = calloc(threads, sizeof(struct NES_Worker));
+
+	if (batch->consoles == NULL || batch->workers == NULL)
+	{
+		free(batch->workers);
+		free(batch->consoles);
+		free(batch);
+		return NULL;
+	}
+
+	batch->consoles[0] = nes_create();
+	if (batch->consoles[0] == NULL || nes_load_rom(batch->consoles[0], filename) != 0)
+	{
+		nes_destroy(batch->consoles[0]);
+		free(batch->workers);
+		free(batch->consoles);
+		free(batch);
+		return NULL;
+	}
+
+	batch->count = 1;
+	for (int i = 1; i < count; i++)
+	{
+		batch->consoles[i] = nes_create_from(batch->consoles[0]);
+
+		if (batch->consoles[i] == NULL)
+		{
+			nes_batch_destroy(batch);
+			return NULL;
+		}
+
+		batch->count++;
+	}
+
+	// the calling thread works the first slice itself
+	nes_detach();
+
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_mutex_lock(&batch->lock);
+
+	int started = 1;
+
+	for (int i = 0; i < threads; i++)
+	{
+		struct NES_Worker* worker = &batch->workers[i];
+
+		worker->batch = batch;
+		worker->first = (int)((long)count * i / threads);
+		worker->last = (int)((long)count * (i + 1) / threads);
+
+		if (i > 0)
+		{
+			if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0)
+				break;
+
+			started++;
+		}
+	}
+
+	bool ready = started == threads && pthread_barrier_init(&batch->start, NULL, threads) == 0;
+
+	if (ready && pthread_barrier_init(&batch->done, NULL, threads) != 0)
+	{
+		pthread_barrier_destroy(&batch->start);
+		ready = false;
+	}
+
+	if (!ready)
+	{
+		batch->quit = 1;
+		pthread_mutex_unlock(&batch->lock);
+
+		for (int i = 1; i < started; i++)
+			pthread_join(batch->workers[i].thread, NULL);
+
+		pthread_mutex_destroy(&batch->lock);
+		nes_batch_destroy(batch);
+		return NULL;
+	}
+
+	batch->threads = threads;
+	pthread_mutex_unlock(&batch->lock);
+
+	return batch;
+}
+
+void nes_batch_destroy(nes_batch_t* batch)
+{
+	if (batch == NULL)
+		return;
+
+	if (batch->threads > 0)
+	{
+		batch->quit = 1;
+		pthread_barrier_wait(&batch->start);
+
+		for (int i = 1; i < batch->threads; i++)
+			pthread_join(batch->workers[i].thread, NULL);
+
+		pthread_barrier_destroy(&batch->start);
+		pthread_barrier_destroy(&batch->done);
+		pthread_mutex_destroy(&batch->lock);
+	}
+
+	nes_detach();
+
+	for (int i = 0; i < batch->count; i++)
+		nes_destroy(batch->consoles[i]);
+
+	free(batch->workers);
+	free(batch->consoles);
+	free(batch);
+}
+
+nes_t* nes_batch_get(nes_batch_t* batch, int index)
+{
+	if (index < 0 || index >= batch->count)
+		return NULL;
+
+	return batch->consoles[index];
+}
+
+void nes_batch_step_frame(nes_batch_t* batch, const uint8_t* inputs)
+{
+	// a console this thread touched since the last step must be parked first
+	nes_detach();
+
+	batch->inputs = inputs;
+
+	pthread_barrier_wait(&batch->start);
+	step_slice(&batch->workers[0]);
+	pthread_barrier_wait(&batch->done);
+}
@@ -0,0 +1,23 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// For the frontend, examples and tools: a monotonic clock to time runs with,
+// and the checksum they print so two runs can be compared.
+
+static inline double seconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static inline uint32_t checksum(const uint8_t* data, size_t size)
+{
+	uint32_t sum = 0;
+	for (size_t i = 0; i < size; i++)
+		sum = sum * 31 + data[i];
+
+	return sum;
+}
@@ -5,6 +5,9 @@
 #include "cartridge.h"
 #include "system.h"
 #include "memory.h"
+#include "cpu.h"
+#include "idle.h"
+#include "state.h"
 
 struct INES_Header
 {
@@ -17,28 +20,118 @@ struct INES_Header
 	uint8_t flags9;
 	uint8_t flags10;
 	char unused[5];
-} header;
+};
 
-enum mirroring_mode cartridge_mirroring;
+CONSOLE_LOCAL enum mirroring_mode cartridge_mirroring;
+CONSOLE_LOCAL uint64_t 	cartridge_hash;
+
+// FNV-1a, used to tie movies and snapshots to the ROM they were made with
+static uint64_t hash_bytes(uint64_t hash, const uint8_t* data, size_t length)
+{
+	for (size_t i = 0; i < length; i++)
+	{
+		hash ^= data[i];
+		hash *= 0x100000001B3ULL;
+	}
+
+	return hash;
+}
+
+int load_cartridge_memory(const uint8_t* data, size_t size)
+{
+	struct INES_Header header;
+
+	if (size < sizeof(struct INES_Header))
+		return 1;
+
+	memcpy(&header, data, sizeof(struct INES_Header));
+
+	// only what fits the flat $8000-$FFFF / $0000-$1FFF layout can be mapped
+	if (memcmp(header.id, "NES\x1A", 4) != 0 ||
+	    header.n_prg_banks < 1 || header.n_prg_banks > 2 ||
+	    header.n_chr_banks > 1)
+		return 1;
+
+	size_t prg_size = 0x4000 * header.n_prg_banks;
+	size_t chr_size = 0x2000 * header.n_chr_banks;
+	size_t prg_offset = sizeof(struct INES_Header) + (header.flags6 & FLAG_6_TRAINER ? 512 : 0);
+
+	if (size < prg_offset + prg_size + chr_size)
+		return 1;
+
+	// a single 16 KiB bank is mirrored into both halves of $8000-$FFFF
+	memcpy(prg_memory, data + prg_offset, prg_size);
+	if (header.n_prg_banks == 1)
+		memcpy(prg_memory + 0x4000, data + prg_offset, prg_size);
+
+	// without CHR-ROM the pattern tables are RAM, blank at power on rather
+	// than whatever the last ROM left there
+	if (chr_size != 0)
+		memcpy(ppu_memory, data + prg_offset + prg_size, chr_size);
+	else
+		memset(ppu_memory, 0, 0x2000);
+
+	cpu_flush_decode_cache();
+	idle_flush();
+
+	cartridge_mirroring = (header.flags6 & FLAG_6_MIRRORING) ? Vertical : Horizontal;
+
+	// NES 2.0 names the TV system in byte 12 (unused[1]); plain iNES can only
+	// flag PAL
+	if ((header.flags7 & FLAG_7_NES2) == 0x08)
+	{
+		static const enum tv_system timings[4] = { NTSC, PAL, NTSC, Dendy };	// multi-region runs as NTSC
+		tv_system = timings[header.unused[1] & 0x3];
+	}
+	else
+		tv_system = (header.flags9 & FLAG_9_PAL) ? PAL : NTSC;
+
+	cartridge_hash = hash_bytes(0xCBF29CE484222325ULL, (uint8_t*)&header, sizeof(struct INES_Header));
+	cartridge_hash = hash_bytes(cartridge_hash, prg_memory, prg_size);
+	cartridge_hash = hash_bytes(cartridge_hash, ppu_memory, chr_size);
+
+	return 0;
+}
 
 int load_cartridge(char* filename)
 {
 	FILE* stream = fopen(filename, "rb");
 
-	if (stream != NULL)
-	{
-		struct INES_Header header;
-		fread(&header, sizeof(struct INES_Header), 1, stream);
+	if (stream == NULL)
+		return 1;
 
-		fread(cpu_memory + 0xC000 - (header.n_prg_banks - 1) * 0x4000, sizeof(uint8_t), 0x4000 * header.n_prg_banks, stream);
+	fseek(stream, 0, SEEK_END);
+	long size = ftell(stream);
+	fseek(stream, 0, SEEK_SET);
 
-		fread(ppu_memory, sizeof(uint8_t), 0x2000 * header.n_chr_banks, stream);
-		
-		cartridge_mirroring = (header.flags6 & FLAG_6_MIRRORING) ? Vertical : Horizontal;
+	uint8_t* data = size > 0 ? malloc(size) : NULL;
+	int result = 1;
 
-		return 0;
-	}
+	if (data != NULL && fread(data, 1, size, stream) == (size_t)size)
+		result = load_cartridge_memory(data, size);
 
-	return 1;
+	free(data);
+	fclose(stream);
+
+	return result;
 }
 
+size_t cartridge_save_state(uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	SAVE_STATE(buffer, offset, cartridge_mirroring);
+	SAVE_STATE(buffer, offset, cartridge_hash);
+
+	return offset;
+}
+
+size_t cartridge_load_state(const uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	LOAD_STATE(buffer, offset, cartridge_mirroring);
+	LOAD_STATE(buffer, offset, cartridge_hash);
+
+	return offset;
+}
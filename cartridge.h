@@ -1,9 +1,20 @@
 #include <stdint.h>
+#include <stddef.h>
+
+#include "console.h"
 
 #define FLAG_6_MIRRORING (1 << 0)
+#define FLAG_6_TRAINER (1 << 2)
+#define FLAG_7_NES2 (0x3 << 2)
+#define FLAG_9_PAL (1 << 0)
 
 enum 			mirroring_mode { Horizontal, Vertical };
-extern enum 		mirroring_mode cartridge_mirroring;
+extern CONSOLE_LOCAL enum 		mirroring_mode cartridge_mirroring;
+extern CONSOLE_LOCAL uint64_t 	cartridge_hash;
 
 int 	load_cartridge(char* filename);
+int 	load_cartridge_memory(const uint8_t* data, size_t size);
+
+size_t 	cartridge_save_state(uint8_t* buffer);
+size_t 	cartridge_load_state(const uint8_t* buffer);
 
@@ -0,0 +1,7 @@
+// Globals that make up one console are thread-local, so a batch can step
+// different consoles on different threads. initial-exec keeps every access a
+// single %fs-relative load, including from libnesemu.so.
+#define CONSOLE_LOCAL __thread __attribute__((tls_model("initial-exec")))
+
+// Defined in nes.c, for batch.c to hand consoles between threads
+void nes_detach();
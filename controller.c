@@ -1,37 +1,76 @@
 #include "controller.h"
 #include "memory.h"
+#include "state.h"
 
-uint8_t controller_state;
-uint8_t shift_register;
+CONSOLE_LOCAL struct Controller_Port controller_ports[CONTROLLER_PORTS] = {
+	{ Controller_Standard, 0x00, 0x00 },
+	{ Controller_Standard, 0x00, 0x00 }
+};
+
+enum input_backend input_backend;
+CONSOLE_LOCAL uint8_t controller_strobe;
 
 void reset_controller()
 {
-	controller_state = 0x00;
+	for (uint8_t i = 0; i < CONTROLLER_PORTS; i++)
+		controller_ports[i].state = 0x00;
+}
+
+void set_controller_state(uint8_t port, uint8_t buttons)
+{
+	if (port < CONTROLLER_PORTS)
+		controller_ports[port].state = buttons;
 }
 
-uint8_t read_controller()
+uint8_t read_controller(uint8_t port)
 {
+	struct Controller_Port* controller = &controller_ports[port];
 	uint8_t data;
 
-	if (cpu_memory[0x4016] & STROBE)
+	// unplugged ports read back as open bus
+	if (controller->type == Controller_None)
+		return 0x40;
+
+	if (controller_strobe & STROBE)
 	{
-		data = (controller_state & STROBE) | 0x40;
+		data = (controller->state & STROBE) | 0x40;
 		return data;
 	}
 
-	data = (shift_register & STROBE) | 0x40;
-	shift_register = (shift_register >> 1) | 0x80;
+	data = (controller->shift_register & STROBE) | 0x40;
+	controller->shift_register = (controller->shift_register >> 1) | 0x80;
 
 	return data;
 }
 
 void write_controller(uint8_t data)
 {
-	if ((cpu_memory[0x4016] & STROBE) && !(data & STROBE))
+	// $4016 strobes every port at once
+	if ((controller_strobe & STROBE) && !(data & STROBE))
 	{
-		shift_register = controller_state;
+		for (uint8_t i = 0; i < CONTROLLER_PORTS; i++)
+			controller_ports[i].shift_register = controller_ports[i].state;
 	}
 
-	cpu_memory[0x4016] = data;
+	controller_strobe = data;
+}
+
+size_t controller_save_state(uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	SAVE_STATE(buffer, offset, controller_ports);
+	SAVE_STATE(buffer, offset, controller_strobe);
+
+	return offset;
 }
 
+size_t controller_load_state(const uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	LOAD_STATE(buffer, offset, controller_ports);
+	LOAD_STATE(buffer, offset, controller_strobe);
+
+	return offset;
+}
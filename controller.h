@@ -0,0 +1,42 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "console.h"
+
+#define STROBE 		(1 << 0)
+
+#define BUTTON_A 	(1 << 0)
+#define BUTTON_B 	(1 << 1)
+#define BUTTON_SELECT 	(1 << 2)
+#define BUTTON_START 	(1 << 3)
+#define BUTTON_UP 	(1 << 4)
+#define BUTTON_DOWN 	(1 << 5)
+#define BUTTON_LEFT 	(1 << 6)
+#define BUTTON_RIGHT 	(1 << 7)
+
+#define CONTROLLER_PORTS 2
+
+// Zapper and Four Score would slot in here with their own read/latch rules
+enum 		controller_type { Controller_None, Controller_Standard };
+
+// where the per-frame button state comes from
+enum 		input_backend { Input_SDL, Input_Movie, Input_API };
+
+struct Controller_Port
+{
+	enum controller_type 	type;
+	uint8_t 		state;		// buttons held, BUTTON_* bits
+	uint8_t 		shift_register;
+};
+
+void 		reset_controller();
+uint8_t 	read_controller(uint8_t port);
+void 		write_controller(uint8_t data);
+void 		set_controller_state(uint8_t port, uint8_t buttons);
+
+size_t 		controller_save_state(uint8_t* buffer);
+size_t 		controller_load_state(const uint8_t* buffer);
+
+extern CONSOLE_LOCAL struct Controller_Port 	controller_ports[CONTROLLER_PORTS];
+extern enum input_backend 	input_backend;
+extern CONSOLE_LOCAL uint8_t 			controller_strobe;
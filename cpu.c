@@ -2,19 +2,26 @@
 #include "controller.h"
 #include "memory.h"
 #include "system.h"
+#include "state.h"
+#include "trace.h"
+#include "jit.h"
+#include "idle.h"
+#include "stats.h"
+#include "profile.h"
 
-uint16_t 	pc;
-uint8_t 	cycles;
-uint32_t 	counter;
-bool 		page_crossed;
+CONSOLE_LOCAL struct CPU 	cpu;
+CONSOLE_LOCAL struct Decode_Cache* 	decode_cache;
+CONSOLE_LOCAL struct Decode_Stats* 	decode_stats;
+
+bool cpu_illegal_exit = true;
 
 void cpu_reset()
 {
-	cpu_registers.a = 0x00;
-	cpu_registers.x = 0x00;
-	cpu_registers.y = 0x00;
-	cpu_registers.sp = 0xFD;
-	cpu_registers.p = 0x00;
+	cpu.a = 0x00;
+	cpu.x = 0x00;
+	cpu.y = 0x00;
+	cpu.sp = 0xFD;
+	cpu.p = 0x00;
 
 	set_cpu_flag(FLAG_U, true);
 	set_cpu_flag(FLAG_I, true);
@@ -22,227 +29,293 @@ void cpu_reset()
 	uint8_t lo = cpu_read(RESET_VECTOR);
 	uint8_t hi = cpu_read(RESET_VECTOR + 1);
 
-	pc = (hi << 8) | lo;
-	cycles = 8;
+	cpu.pc = (hi << 8) | lo;
+	cpu.cycles = 8;
+	cpu.dma_cycles = 0;
 
-	counter = 0;
+	cpu.counter = 0;
 }
 
-// Addressing modes
-static inline uint16_t absolute()
+// Addressing modes. Each *_operand() turns the raw operand of an instruction
+// into the address it works on; next is the address of the following
+// instruction. The plain versions fetch the operand from pc first.
+static inline uint16_t fetch_byte()
 {
-	uint16_t lo = cpu_read(pc);
-	pc++;
+	uint16_t data = cpu_read(cpu.pc);
+	cpu.pc++;
 
-	uint16_t hi = cpu_read(pc);
-	pc++;
+	return data;
+}
 
-	uint16_t address = (hi << 8) | lo;
-	return address;
+static inline uint16_t fetch_word()
+{
+	uint16_t lo = cpu_read(cpu.pc);
+	cpu.pc++;
+	uint16_t hi = cpu_read(cpu.pc);
+	cpu.pc++;
+
+	return (hi << 8) | lo;
 }
 
-static inline uint16_t immediate()
+static inline uint16_t absolute_operand(uint16_t operand, uint16_t next)
 {
-	uint16_t address = pc++;
-	return address;
+	return operand;
 }
 
-static inline uint16_t zeropage()
+static inline uint16_t immediate_operand(uint16_t operand, uint16_t next)
 {
-	uint16_t address = cpu_read(pc);
-	address &= 0x00FF;
-	pc++;
+	return next - 1;
+}
 
-	return address;
+static inline uint16_t zeropage_operand(uint16_t operand, uint16_t next)
+{
+	return operand & 0x00FF;
 }
 
-static inline uint16_t zeropagex()
+static inline uint16_t zeropagex_operand(uint16_t operand, uint16_t next)
 {
-	uint16_t address = (cpu_read(pc) + cpu_registers.x);
-	address &= 0x00FF;
-	pc++;
+	return (operand + cpu.x) & 0x00FF;
+}
 
-	return address;
+static inline uint16_t zeropagey_operand(uint16_t operand, uint16_t next)
+{
+	return (operand + cpu.y) & 0x00FF;
 }
 
-static inline uint16_t zeropagey()
+static inline uint16_t absolutex_operand(uint16_t operand, uint16_t next)
 {
-	uint16_t address = (cpu_read(pc) + cpu_registers.y);
-	address &= 0x00FF;
-	pc++;
+	uint16_t address = operand + cpu.x;
+
+	if ((address & 0xFF00) != (operand & 0xFF00))
+		cpu.page_crossed = true;
 
 	return address;
 }
 
-static inline uint16_t absolutex()
+static inline uint16_t absolutey_operand(uint16_t operand, uint16_t next)
 {
-	uint16_t lo = cpu_read(pc);
-	pc++;
-	uint16_t hi = cpu_read(pc);
-	pc++;
+	uint16_t address = operand + cpu.y;
 
-	uint16_t address = (hi << 8) | lo;
-	address += cpu_registers.x;
+	if ((address & 0xFF00) != (operand & 0xFF00))
+		cpu.page_crossed = true;
 
-	if ((address & 0xFF00) != (hi << 8))
-		page_crossed = true;
+	return address;
+}
+
+static inline uint16_t indirect_operand(uint16_t operand, uint16_t next)
+{
+	uint16_t address;
 
+	if ((operand & 0x00FF) == 0x00FF)
+		address = (cpu_read(operand & 0xFF00) << 8) | cpu_read(operand);
+	else
+		address = (cpu_read(operand + 1) << 8 | cpu_read(operand));
 
 	return address;
 }
 
-static inline uint16_t absolutey()
+static inline uint16_t indirectx_operand(uint16_t operand, uint16_t next)
 {
-	uint16_t lo = cpu_read(pc);
-	pc++;
-	uint16_t hi = cpu_read(pc);
-	pc++;
+	uint16_t lo = cpu_read((operand + cpu.x) & 0x00FF);
+	uint16_t hi = cpu_read((operand + cpu.x + 1) & 0x00FF);
+
+	return (hi << 8) | lo;
+}
+
+static inline uint16_t indirecty_operand(uint16_t operand, uint16_t next)
+{
+	uint16_t lo = cpu_read(operand & 0x00FF);
+	uint16_t hi = cpu_read((operand + 1) & 0x00FF);
 
 	uint16_t address = (hi << 8) | lo;
-	address += cpu_registers.y;
+	address += cpu.y;
 
 	if ((address & 0xFF00) != (hi << 8))
-		page_crossed = true;
+		cpu.page_crossed = true;
 
 	return address;
 }
 
-static inline uint16_t indirect()
+static inline uint16_t relative_operand(uint16_t operand, uint16_t next)
 {
-	uint16_t lo = cpu_read(pc);
-	pc++;
-	uint16_t hi = cpu_read(pc);
-	pc++;
+	uint16_t address = operand & 0x00FF;
 
-	uint16_t ptr = (hi << 8) | lo;
-	uint16_t address;
-
-	if (lo == 0x00FF)
-		address = (cpu_read(ptr & 0xFF00) << 8) | cpu_read(ptr);
-	else
-		address = (cpu_read(ptr + 1) << 8 | cpu_read(ptr));
+	if (address & 0x80)
+		address |= 0xFF00;
 
 	return address;
 }
 
-static inline uint16_t indirectx()
+static inline uint16_t absolute()
 {
-	uint16_t m = cpu_read(pc);
-	pc++;
-
-	uint16_t lo = cpu_read((m + cpu_registers.x) & 0x00FF);
-	uint16_t hi = cpu_read((m + cpu_registers.x + 1) & 0x00FF);
-
-	uint16_t address = (hi << 8) | lo;
+	uint16_t operand = fetch_word();
+	return absolute_operand(operand, cpu.pc);
+}
 
-	return address;
+static inline uint16_t immediate()
+{
+	cpu.pc++;
+	return immediate_operand(0, cpu.pc);
 }
 
-static inline uint16_t indirecty()
+static inline uint16_t zeropage()
 {
-	uint16_t m = cpu_read(pc);
-	pc++;
+	uint16_t operand = fetch_byte();
+	return zeropage_operand(operand, cpu.pc);
+}
 
-	uint16_t lo = cpu_read(m & 0x00FF);
-	uint16_t hi = cpu_read((m + 1) & 0x00FF);
+static inline uint16_t zeropagex()
+{
+	uint16_t operand = fetch_byte();
+	return zeropagex_operand(operand, cpu.pc);
+}
 
-	uint16_t address = (hi << 8) | lo;
-	address += cpu_registers.y;
+static inline uint16_t zeropagey()
+{
+	uint16_t operand = fetch_byte();
+	return zeropagey_operand(operand, cpu.pc);
+}
 
-	if ((address & 0xFF00) != (hi << 8))
-		page_crossed = true;
+static inline uint16_t absolutex()
+{
+	uint16_t operand = fetch_word();
+	return absolutex_operand(operand, cpu.pc);
+}
 
-	return address;
+static inline uint16_t absolutey()
+{
+	uint16_t operand = fetch_word();
+	return absolutey_operand(operand, cpu.pc);
 }
 
-static inline uint16_t relative()
+static inline uint16_t indirect()
 {
-	uint16_t address = cpu_read(pc);
-	pc++;
+	uint16_t operand = fetch_word();
+	return indirect_operand(operand, cpu.pc);
+}
 
-	if (address & 0x80)
-		address |= 0xFF00;
+static inline uint16_t indirectx()
+{
+	uint16_t operand = fetch_byte();
+	return indirectx_operand(operand, cpu.pc);
+}
 
-	return address;
+static inline uint16_t indirecty()
+{
+	uint16_t operand = fetch_byte();
+	return indirecty_operand(operand, cpu.pc);
 }
 
+static inline uint16_t relative()
+{
+	uint16_t operand = fetch_byte();
+	return relative_operand(operand, cpu.pc);
+}
+
+// Operand sizes, and whether the resolved address may be one of the I/O
+// registers at $2000-$401F (immediates and branch offsets never are). PPUDATA
+// is not I/O while ppu_data_deferrable() says so.
+#define LENGTH_absolute 	3
+#define LENGTH_immediate 	2
+#define LENGTH_zeropage 	2
+#define LENGTH_zeropagex 	2
+#define LENGTH_zeropagey 	2
+#define LENGTH_absolutex 	3
+#define LENGTH_absolutey 	3
+#define LENGTH_indirect 	3
+#define LENGTH_indirectx 	2
+#define LENGTH_indirecty 	2
+#define LENGTH_relative 	2
+
+#define IO_absolute(a) 		((uint16_t)((a) - 0x2000) < 0x2020 && !ppu_data_deferrable(a))
+#define IO_immediate(a) 	false
+#define IO_zeropage(a) 		false
+#define IO_zeropagex(a) 	false
+#define IO_zeropagey(a) 	false
+#define IO_absolutex(a) 	IO_absolute(a)
+#define IO_absolutey(a) 	IO_absolute(a)
+#define IO_indirect(a) 		false
+#define IO_indirectx(a) 	IO_absolute(a)
+#define IO_indirecty(a) 	IO_absolute(a)
+#define IO_relative(a) 		false
+
 // Logical & arithmetic commands
 static inline void ora(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	cpu_registers.a |= m;
+	cpu.a |= m;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void and(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	cpu_registers.a &= m;
+	cpu.a &= m;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void eor(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	cpu_registers.a ^= m;
+	cpu.a ^= m;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void adc(uint16_t address) 
 {
 	uint16_t m = cpu_read(address);
-	uint16_t sum = cpu_registers.a + m + (is_cpu_flag_set(FLAG_C) ? 1 : 0);
+	uint16_t sum = cpu.a + m + (is_cpu_flag_set(FLAG_C) ? 1 : 0);
 
 	set_cpu_flag(FLAG_C, sum > 0x00FF);
 	set_cpu_flag(FLAG_Z, (sum & 0x00FF) == 0x0000);
 	set_cpu_flag(FLAG_N, sum & 0x0080);
-	set_cpu_flag(FLAG_V, (~(cpu_registers.a ^ m) & (cpu_registers.a ^ sum)) & 0x0080);
+	set_cpu_flag(FLAG_V, (~(cpu.a ^ m) & (cpu.a ^ sum)) & 0x0080);
 
-	cpu_registers.a = sum & 0xFF;
+	cpu.a = sum & 0xFF;
 }
 
 static inline void sbc(uint16_t address)
 {
 	uint16_t m = cpu_read(address);
 	m ^= 0x00FF;
-	uint16_t sum = cpu_registers.a + m + (is_cpu_flag_set(FLAG_C) ? 1 : 0);
+	uint16_t sum = cpu.a + m + (is_cpu_flag_set(FLAG_C) ? 1 : 0);
 
 	set_cpu_flag(FLAG_C, sum & 0xFF00);
 	set_cpu_flag(FLAG_Z, (sum & 0x00FF) == 0x0000);
 	set_cpu_flag(FLAG_N, sum & 0x0080);
-	set_cpu_flag(FLAG_V, (sum ^ cpu_registers.a) & (sum ^ m) & 0x0080);
+	set_cpu_flag(FLAG_V, (sum ^ cpu.a) & (sum ^ m) & 0x0080);
 
-	cpu_registers.a = sum & 0xFF;
+	cpu.a = sum & 0xFF;
 }
 
 static inline void cmp(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	set_cpu_flag(FLAG_Z, cpu_registers.a == m);
-	set_cpu_flag(FLAG_C, cpu_registers.a >= m);
-	set_cpu_flag(FLAG_N, (cpu_registers.a - m) & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == m);
+	set_cpu_flag(FLAG_C, cpu.a >= m);
+	set_cpu_flag(FLAG_N, (cpu.a - m) & 0x80);
 }
 
 static inline void cpx(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	set_cpu_flag(FLAG_Z, cpu_registers.x == m);
-	set_cpu_flag(FLAG_C, cpu_registers.x >= m);
-	set_cpu_flag(FLAG_N, (cpu_registers.x - m) & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.x == m);
+	set_cpu_flag(FLAG_C, cpu.x >= m);
+	set_cpu_flag(FLAG_N, (cpu.x - m) & 0x80);
 }
 
 static inline void cpy(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	set_cpu_flag(FLAG_Z, cpu_registers.y == m);
-	set_cpu_flag(FLAG_C, cpu_registers.y >= m);
-	set_cpu_flag(FLAG_N, (cpu_registers.y - m) & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.y == m);
+	set_cpu_flag(FLAG_C, cpu.y >= m);
+	set_cpu_flag(FLAG_N, (cpu.y - m) & 0x80);
 }
 
 static inline void dec(uint16_t address)
@@ -258,18 +331,18 @@ static inline void dec(uint16_t address)
 
 static inline void dex()
 {
-	cpu_registers.x--;
+	cpu.x--;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.x == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.x & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.x == 0x00);
+	set_cpu_flag(FLAG_N, cpu.x & 0x80);
 }
 
 static inline void dey()
 {
-	cpu_registers.y--;
+	cpu.y--;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.y == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.y & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.y == 0x00);
+	set_cpu_flag(FLAG_N, cpu.y & 0x80);
 }
 
 static inline void inc(uint16_t address)
@@ -285,28 +358,28 @@ static inline void inc(uint16_t address)
 
 static inline void inx()
 {
-	cpu_registers.x++;
+	cpu.x++;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.x == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.x & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.x == 0x00);
+	set_cpu_flag(FLAG_N, cpu.x & 0x80);
 }
 
 static inline void iny()
 {
-	cpu_registers.y++;
+	cpu.y++;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.y == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.y & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.y == 0x00);
+	set_cpu_flag(FLAG_N, cpu.y & 0x80);
 }
 
 static inline void asl_a()
 {
-	set_cpu_flag(FLAG_C, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_C, cpu.a & 0x80);
 
-	cpu_registers.a <<= 1;
+	cpu.a <<= 1;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void asl_m(uint16_t address)
@@ -323,15 +396,15 @@ static inline void asl_m(uint16_t address)
 
 static inline void rol_a()
 {
-	uint8_t a_prev = cpu_registers.a;
-	cpu_registers.a <<= 1;
+	uint8_t a_prev = cpu.a;
+	cpu.a <<= 1;
 
 	if (is_cpu_flag_set(FLAG_C))
-		cpu_registers.a |= 0x01;
+		cpu.a |= 0x01;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
 	set_cpu_flag(FLAG_C, a_prev & 0x80);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void rol_m(uint16_t address)
@@ -352,12 +425,12 @@ static inline void rol_m(uint16_t address)
 
 static inline void lsr_a()
 {
-	set_cpu_flag(FLAG_C, cpu_registers.a & 0x01);
+	set_cpu_flag(FLAG_C, cpu.a & 0x01);
 
-	cpu_registers.a >>= 1;
+	cpu.a >>= 1;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void lsr_m(uint16_t address)
@@ -376,14 +449,14 @@ static inline void lsr_m(uint16_t address)
 
 static inline void ror_a()
 {
-	uint8_t a_prev = cpu_registers.a;
-	cpu_registers.a >>= 1;
+	uint8_t a_prev = cpu.a;
+	cpu.a >>= 1;
 
 	if (is_cpu_flag_set(FLAG_C))
-		cpu_registers.a |= 0x80;
+		cpu.a |= 0x80;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 	set_cpu_flag(FLAG_C, a_prev & 0x01);
 }
 
@@ -409,115 +482,115 @@ static inline void ror_m(uint16_t address)
 static inline void lda(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	cpu_registers.a = m;
+	cpu.a = m;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void sta(uint16_t address)
 {
-	cpu_write(address, cpu_registers.a);
+	cpu_write(address, cpu.a);
 }
 
 static inline void ldx(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	cpu_registers.x = m;
+	cpu.x = m;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.x == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.x & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.x == 0x00);
+	set_cpu_flag(FLAG_N, cpu.x & 0x80);
 }
 
 static inline void stx(uint16_t address)
 {
-	cpu_write(address, cpu_registers.x);
+	cpu_write(address, cpu.x);
 }
 
 static inline void ldy(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
-	cpu_registers.y = m;
+	cpu.y = m;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.y == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.y & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.y == 0x00);
+	set_cpu_flag(FLAG_N, cpu.y & 0x80);
 }
 
 static inline void sty(uint16_t address)
 {
-	cpu_write(address, cpu_registers.y);
+	cpu_write(address, cpu.y);
 }
 
 static inline void tax()
 {
-	cpu_registers.x = cpu_registers.a;
-	set_cpu_flag(FLAG_Z, cpu_registers.x == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.x & 0x80);
+	cpu.x = cpu.a;
+	set_cpu_flag(FLAG_Z, cpu.x == 0x00);
+	set_cpu_flag(FLAG_N, cpu.x & 0x80);
 }
 
 static inline void txa()
 {
-	cpu_registers.a = cpu_registers.x;
+	cpu.a = cpu.x;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void tay()
 {
-	cpu_registers.y = cpu_registers.a;
+	cpu.y = cpu.a;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.y == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.y & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.y == 0x00);
+	set_cpu_flag(FLAG_N, cpu.y & 0x80);
 }
 
 static inline void tya()
 {
-	cpu_registers.a = cpu_registers.y;
+	cpu.a = cpu.y;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void tsx()
 {
-	cpu_registers.x = cpu_registers.sp;
+	cpu.x = cpu.sp;
 
-	set_cpu_flag(FLAG_Z, cpu_registers.x == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.x & 0x80);
+	set_cpu_flag(FLAG_Z, cpu.x == 0x00);
+	set_cpu_flag(FLAG_N, cpu.x & 0x80);
 }
 
 static inline void txs()
 {
-	cpu_registers.sp = cpu_registers.x;
+	cpu.sp = cpu.x;
 }
 
 static inline void pla()
 {
-	cpu_registers.sp++;
-	cpu_registers.a = cpu_read(0x100 + cpu_registers.sp);
-	set_cpu_flag(FLAG_Z, cpu_registers.a == 0x00);
-	set_cpu_flag(FLAG_N, cpu_registers.a & 0x80);
+	cpu.sp++;
+	cpu.a = cpu_read(0x100 + cpu.sp);
+	set_cpu_flag(FLAG_Z, cpu.a == 0x00);
+	set_cpu_flag(FLAG_N, cpu.a & 0x80);
 }
 
 static inline void pha()
 {
-	cpu_write(0x0100 + cpu_registers.sp, cpu_registers.a);
-	cpu_registers.sp--;
+	cpu_write(0x0100 + cpu.sp, cpu.a);
+	cpu.sp--;
 }
 
 static inline void plp()
 {
-	cpu_registers.sp++;
-	cpu_registers.p = cpu_read(0x100 + cpu_registers.sp);
+	cpu.sp++;
+	cpu.p = cpu_read(0x100 + cpu.sp);
 }
 
 static inline void php()
 {
 	set_cpu_flag(FLAG_U, true);
 	set_cpu_flag(FLAG_B, true);
-	cpu_write(0x0100 + cpu_registers.sp, cpu_registers.p);
-	cpu_registers.sp--;
+	cpu_write(0x0100 + cpu.sp, cpu.p);
+	cpu.sp--;
 }
 
 
@@ -525,12 +598,12 @@ static inline void php()
 
 static inline void _branch(uint16_t address)
 {
-	address += pc;
+	address += cpu.pc;
 
-	if ((address & 0xFF00) != (pc & 0xFF00))
-		page_crossed = true;
+	if ((address & 0xFF00) != (cpu.pc & 0xFF00))
+		cpu.page_crossed = true;
 
-	pc = address;
+	cpu.pc = address;
 }
 
 static inline void bpl(uint16_t address)
@@ -583,94 +656,123 @@ static inline void beq(uint16_t address)
 
 static inline void brk()
 {
-	pc++;
+	cpu.pc++;
 
-	cpu_write(0x0100 + cpu_registers.sp, (pc >> 8) & 0x00FF);
-	cpu_registers.sp--;
-	cpu_write(0x0100 + cpu_registers.sp, pc & 0x00FF);
-	cpu_registers.sp--;
+	cpu_write(0x0100 + cpu.sp, (cpu.pc >> 8) & 0x00FF);
+	cpu.sp--;
+	cpu_write(0x0100 + cpu.sp, cpu.pc & 0x00FF);
+	cpu.sp--;
 
 	set_cpu_flag(FLAG_U, true);
 	set_cpu_flag(FLAG_B, true);
-	cpu_write(0x0100 + cpu_registers.sp, cpu_registers.p);
-	cpu_registers.sp--;
+	cpu_write(0x0100 + cpu.sp, cpu.p);
+	cpu.sp--;
 	
 	set_cpu_flag(FLAG_I, true);
 
 	uint16_t lo = cpu_read(IRQ_VECTOR);
 	uint16_t hi = cpu_read(IRQ_VECTOR + 1);
 
-	pc = (hi << 8) | lo;
+	cpu.pc = (hi << 8) | lo;
 }
 
 static inline void rti()
 {
-	cpu_registers.sp++;
-	cpu_registers.p = cpu_read(0x0100 + cpu_registers.sp);
+	cpu.sp++;
+	cpu.p = cpu_read(0x0100 + cpu.sp);
 	set_cpu_flag(FLAG_B, false);
 	set_cpu_flag(FLAG_U, false);
 
-	cpu_registers.sp++;
-	uint8_t lo = cpu_read(0x100 + cpu_registers.sp);
-	cpu_registers.sp++;
-	uint8_t hi = cpu_read(0x100 + cpu_registers.sp);
+	cpu.sp++;
+	uint8_t lo = cpu_read(0x100 + cpu.sp);
+	cpu.sp++;
+	uint8_t hi = cpu_read(0x100 + cpu.sp);
 
-	pc = (hi << 8) | lo;
+	cpu.pc = (hi << 8) | lo;
 }
 
 void nmi()
 {
-	cpu_write(0x0100 + cpu_registers.sp, pc >> 8);
-	cpu_registers.sp--;
-	cpu_write(0x0100 + cpu_registers.sp, pc);
-	cpu_registers.sp--;
+	cpu_write(0x0100 + cpu.sp, cpu.pc >> 8);
+	cpu.sp--;
+	cpu_write(0x0100 + cpu.sp, cpu.pc);
+	cpu.sp--;
 
 	set_cpu_flag(FLAG_B, false);
 	set_cpu_flag(FLAG_U, true);
+	cpu_write(0x0100 + cpu.sp, cpu.p);
+	cpu.sp--;
 	set_cpu_flag(FLAG_I, true);
-	cpu_write(0x0100 + cpu_registers.sp, cpu_registers.p);
-	cpu_registers.sp--;
 
 	uint8_t lo = cpu_read(NMI_VECTOR);
 	uint8_t hi = cpu_read(NMI_VECTOR + 1);
 
-	pc = (hi << 8) | lo;
+	cpu.pc = (hi << 8) | lo;
+
+	cpu.cycles = 8;
 
-	cycles = 8;
+	PROFILE_INTERRUPT(cpu.cycles);
+}
+
+// Level triggered, so only taken between instructions while I is clear.
+void irq()
+{
+	if (cpu.cycles != 0 || is_cpu_flag_set(FLAG_I))
+		return;
+
+	cpu_write(0x0100 + cpu.sp, cpu.pc >> 8);
+	cpu.sp--;
+	cpu_write(0x0100 + cpu.sp, cpu.pc);
+	cpu.sp--;
+
+	set_cpu_flag(FLAG_B, false);
+	set_cpu_flag(FLAG_U, true);
+	cpu_write(0x0100 + cpu.sp, cpu.p);
+	cpu.sp--;
+	set_cpu_flag(FLAG_I, true);
+
+	uint8_t lo = cpu_read(IRQ_VECTOR);
+	uint8_t hi = cpu_read(IRQ_VECTOR + 1);
+
+	cpu.pc = (hi << 8) | lo;
+
+	cpu.cycles = 7;
+
+	PROFILE_INTERRUPT(cpu.cycles);
 }
 
 static inline void jsr(uint16_t address)
 {
-	pc--;
-	cpu_write(0x0100 + cpu_registers.sp, (pc >> 8) & 0x00FF);
-	cpu_registers.sp--;
-	cpu_write(0x0100 + cpu_registers.sp, pc & 0x00FF);
-	cpu_registers.sp--;
+	cpu.pc--;
+	cpu_write(0x0100 + cpu.sp, (cpu.pc >> 8) & 0x00FF);
+	cpu.sp--;
+	cpu_write(0x0100 + cpu.sp, cpu.pc & 0x00FF);
+	cpu.sp--;
 
-	pc = address;
+	cpu.pc = address;
 }
 
 static inline void rts()
 {
-	cpu_registers.sp++;
-	uint8_t lo = cpu_read(0x100 + cpu_registers.sp);
-	cpu_registers.sp++;
-	uint8_t hi = cpu_read(0x100 + cpu_registers.sp);
+	cpu.sp++;
+	uint8_t lo = cpu_read(0x100 + cpu.sp);
+	cpu.sp++;
+	uint8_t hi = cpu_read(0x100 + cpu.sp);
 
-	pc = (hi << 8) | lo;
-	pc++;
+	cpu.pc = (hi << 8) | lo;
+	cpu.pc++;
 }
 
 static inline void jmp(uint16_t address)
 {
-	pc = address;
+	cpu.pc = address;
 }
 
 static inline void bit(uint16_t address)
 {
 	uint8_t m = cpu_read(address);
 
-	set_cpu_flag(FLAG_Z, (cpu_registers.a & m) == 0x00);
+	set_cpu_flag(FLAG_Z, (cpu.a & m) == 0x00);
 	set_cpu_flag(FLAG_N, m & 0x80);
 	set_cpu_flag(FLAG_V, m & 0x40);
 }
@@ -717,247 +819,379 @@ static inline void xxx()
 {
 }
 
+// Every opcode the CPU knows and how it addresses memory. Expanded into the
+// interpreter's switch below and into the handler table used by code that
+// has already decoded the instruction (see jit.c).
+#define CPU_OPCODES(OP, IMPLIED) \
+	OP(0x69, adc, immediate) \
+	OP(0x65, adc, zeropage) \
+	OP(0x75, adc, zeropagex) \
+	OP(0x6d, adc, absolute) \
+	OP(0x7d, adc, absolutex) \
+	OP(0x79, adc, absolutey) \
+	OP(0x61, adc, indirectx) \
+	OP(0x71, adc, indirecty) \
+	OP(0x29, and, immediate) \
+	OP(0x25, and, zeropage) \
+	OP(0x35, and, zeropagex) \
+	OP(0x2d, and, absolute) \
+	OP(0x3d, and, absolutex) \
+	OP(0x39, and, absolutey) \
+	OP(0x21, and, indirectx) \
+	OP(0x31, and, indirecty) \
+	IMPLIED(0x0a, asl_a) \
+	OP(0x06, asl_m, zeropage) \
+	OP(0x16, asl_m, zeropagex) \
+	OP(0x0e, asl_m, absolute) \
+	OP(0x1e, asl_m, absolutex) \
+	OP(0x90, bcc, relative) \
+	OP(0xb0, bcs, relative) \
+	OP(0xf0, beq, relative) \
+	OP(0x30, bmi, relative) \
+	OP(0xd0, bne, relative) \
+	OP(0x10, bpl, relative) \
+	OP(0x24, bit, zeropage) \
+	OP(0x2c, bit, absolute) \
+	IMPLIED(0x00, brk) \
+	OP(0x50, bvc, relative) \
+	OP(0x70, bvs, relative) \
+	IMPLIED(0x18, clc) \
+	IMPLIED(0xd8, cld) \
+	IMPLIED(0x58, cli) \
+	IMPLIED(0xb8, clv) \
+	OP(0xc9, cmp, immediate) \
+	OP(0xc5, cmp, zeropage) \
+	OP(0xd5, cmp, zeropagex) \
+	OP(0xcd, cmp, absolute) \
+	OP(0xdd, cmp, absolutex) \
+	OP(0xd9, cmp, absolutey) \
+	OP(0xc1, cmp, indirectx) \
+	OP(0xd1, cmp, indirecty) \
+	OP(0xe0, cpx, immediate) \
+	OP(0xe4, cpx, zeropage) \
+	OP(0xec, cpx, absolute) \
+	OP(0xc0, cpy, immediate) \
+	OP(0xc4, cpy, zeropage) \
+	OP(0xcc, cpy, absolute) \
+	OP(0xc6, dec, zeropage) \
+	OP(0xd6, dec, zeropagex) \
+	OP(0xce, dec, absolute) \
+	OP(0xde, dec, absolutex) \
+	IMPLIED(0xca, dex) \
+	IMPLIED(0x88, dey) \
+	OP(0x49, eor, immediate) \
+	OP(0x45, eor, zeropage) \
+	OP(0x55, eor, zeropagex) \
+	OP(0x4d, eor, absolute) \
+	OP(0x5d, eor, absolutex) \
+	OP(0x59, eor, absolutey) \
+	OP(0x41, eor, indirectx) \
+	OP(0x51, eor, indirecty) \
+	OP(0xe6, inc, zeropage) \
+	OP(0xf6, inc, zeropagex) \
+	OP(0xee, inc, absolute) \
+	OP(0xfe, inc, absolutex) \
+	IMPLIED(0xe8, inx) \
+	IMPLIED(0xc8, iny) \
+	OP(0x4c, jmp, absolute) \
+	OP(0x6c, jmp, indirect) \
+	OP(0x20, jsr, absolute) \
+	OP(0xa9, lda, immediate) \
+	OP(0xa5, lda, zeropage) \
+	OP(0xb5, lda, zeropagex) \
+	OP(0xad, lda, absolute) \
+	OP(0xbd, lda, absolutex) \
+	OP(0xb9, lda, absolutey) \
+	OP(0xa1, lda, indirectx) \
+	OP(0xb1, lda, indirecty) \
+	OP(0xa2, ldx, immediate) \
+	OP(0xa6, ldx, zeropage) \
+	OP(0xb6, ldx, zeropagey) \
+	OP(0xae, ldx, absolute) \
+	OP(0xbe, ldx, absolutey) \
+	OP(0xa0, ldy, immediate) \
+	OP(0xa4, ldy, zeropage) \
+	OP(0xb4, ldy, zeropagex) \
+	OP(0xac, ldy, absolute) \
+	OP(0xbc, ldy, absolutex) \
+	IMPLIED(0x4a, lsr_a) \
+	OP(0x46, lsr_m, zeropage) \
+	OP(0x56, lsr_m, zeropagex) \
+	OP(0x4e, lsr_m, absolute) \
+	OP(0x5e, lsr_m, absolutex) \
+	OP(0x80, nop, immediate) \
+	OP(0x04, nop, zeropage) \
+	OP(0x44, nop, zeropage) \
+	OP(0x64, nop, zeropage) \
+	OP(0x0c, nop, absolute) \
+	OP(0x14, nop, zeropagex) \
+	OP(0x34, nop, zeropagex) \
+	OP(0x54, nop, zeropagex) \
+	OP(0x74, nop, zeropagex) \
+	OP(0xd4, nop, zeropagex) \
+	OP(0xf4, nop, zeropagex) \
+	IMPLIED(0x1a, nop) \
+	IMPLIED(0x3a, nop) \
+	IMPLIED(0x5a, nop) \
+	IMPLIED(0x7a, nop) \
+	IMPLIED(0xda, nop) \
+	IMPLIED(0xea, nop) \
+	IMPLIED(0xfa, nop) \
+	OP(0x1c, nop, absolutex) \
+	OP(0x3c, nop, absolutex) \
+	OP(0x5c, nop, absolutex) \
+	OP(0x7c, nop, absolutex) \
+	OP(0xdc, nop, absolutex) \
+	OP(0xfc, nop, absolutex) \
+	OP(0x09, ora, immediate) \
+	OP(0x05, ora, zeropage) \
+	OP(0x15, ora, zeropagex) \
+	OP(0x0d, ora, absolute) \
+	OP(0x1d, ora, absolutex) \
+	OP(0x19, ora, absolutey) \
+	OP(0x01, ora, indirectx) \
+	OP(0x11, ora, indirecty) \
+	IMPLIED(0x48, pha) \
+	IMPLIED(0x08, php) \
+	IMPLIED(0x68, pla) \
+	IMPLIED(0x28, plp) \
+	IMPLIED(0x2a, rol_a) \
+	OP(0x26, rol_m, zeropage) \
+	OP(0x36, rol_m, zeropagex) \
+	OP(0x2e, rol_m, absolute) \
+	OP(0x3e, rol_m, absolutex) \
+	IMPLIED(0x6a, ror_a) \
+	OP(0x66, ror_m, zeropage) \
+	OP(0x76, ror_m, zeropagex) \
+	OP(0x6e, ror_m, absolute) \
+	OP(0x7e, ror_m, absolutex) \
+	IMPLIED(0x40, rti) \
+	IMPLIED(0x60, rts) \
+	OP(0xe9, sbc, immediate) \
+	OP(0xe5, sbc, zeropage) \
+	OP(0xf5, sbc, zeropagex) \
+	OP(0xed, sbc, absolute) \
+	OP(0xfd, sbc, absolutex) \
+	OP(0xf9, sbc, absolutey) \
+	OP(0xe1, sbc, indirectx) \
+	OP(0xf1, sbc, indirecty) \
+	IMPLIED(0x38, sec) \
+	IMPLIED(0xf8, sed) \
+	IMPLIED(0x78, sei) \
+	OP(0x85, sta, zeropage) \
+	OP(0x95, sta, zeropagex) \
+	OP(0x8d, sta, absolute) \
+	OP(0x9d, sta, absolutex) \
+	OP(0x99, sta, absolutey) \
+	OP(0x81, sta, indirectx) \
+	OP(0x91, sta, indirecty) \
+	OP(0x86, stx, zeropage) \
+	OP(0x96, stx, zeropagey) \
+	OP(0x8e, stx, absolute) \
+	OP(0x84, sty, zeropage) \
+	OP(0x94, sty, zeropagex) \
+	OP(0x8c, sty, absolute) \
+	IMPLIED(0xaa, tax) \
+	IMPLIED(0xa8, tay) \
+	IMPLIED(0xba, tsx) \
+	IMPLIED(0x8a, txa) \
+	IMPLIED(0x9a, txs) \
+	IMPLIED(0x98, tya)
+
+static inline uint8_t instruction_cycles(uint8_t opcode)
+{
+	uint8_t count = lut_cycles[opcode];
+
+	if (cpu.page_crossed)
+	{
+		if (lut_pagecrosses[opcode])
+		{
+			count++;
+		}
+		cpu.page_crossed = false;
+	}
+
+	return count;
+}
+
+// Runs one instruction whose operand bytes have already been fetched, with
+// pc ending up at next. Returns its cycles, or 0 without touching anything
+// if it would access $2000-$401F: only the interpreter reaches the I/O
+// registers, on the exact cycle.
+#define HANDLER(code, fn, mode) \
+static uint8_t handle_##code(uint16_t operand, uint16_t next) \
+{ \
+	uint16_t address = mode##_operand(operand, next); \
+	if (IO_##mode(address)) \
+	{ \
+		cpu.page_crossed = false; \
+		return 0; \
+	} \
+	cpu.pc = next; \
+	fn(address); \
+	return instruction_cycles(code); \
+}
+
+#define HANDLER_IMPLIED(code, fn) \
+static uint8_t handle_##code(uint16_t operand, uint16_t next) \
+{ \
+	cpu.pc = next; \
+	fn(); \
+	return instruction_cycles(code); \
+}
+
+CPU_OPCODES(HANDLER, HANDLER_IMPLIED)
+
+#define HANDLER_ENTRY(code, fn, mode) 		[code] = handle_##code,
+#define HANDLER_ENTRY_IMPLIED(code, fn) 	[code] = handle_##code,
+#define LENGTH_ENTRY(code, fn, mode) 		[code] = LENGTH_##mode,
+#define LENGTH_ENTRY_IMPLIED(code, fn) 		[code] = 1,
+
+const cpu_handler cpu_handlers[256] = { CPU_OPCODES(HANDLER_ENTRY, HANDLER_ENTRY_IMPLIED) };
+const uint8_t cpu_lengths[256] = { CPU_OPCODES(LENGTH_ENTRY, LENGTH_ENTRY_IMPLIED) };
+
+// For when PRG changes under the cache (a new ROM, a bank switch). Nothing
+// may be running from it.
+void cpu_flush_decode_cache()
+{
+	memset(decode_cache->entries, 0, sizeof(decode_cache->entries));
+	memset(decode_stats, 0, sizeof(struct Decode_Stats));
+}
+
+static void decode(struct Decoded_Instruction* entry)
+{
+	pthread_mutex_lock(&decode_cache->lock);
+
+	// another console on the cartridge may have got there first
+	if (entry->handler == NULL)
+	{
+		uint8_t opcode = prg_memory[cpu.pc & 0x7FFF];
+
+		entry->operand = 0;
+		if (cpu_lengths[opcode] > 1)
+			entry->operand = prg_memory[(cpu.pc + 1) & 0x7FFF];
+		if (cpu_lengths[opcode] > 2)
+			entry->operand |= prg_memory[(cpu.pc + 2) & 0x7FFF] << 8;
+
+		entry->next = cpu.pc + cpu_lengths[opcode];
+		__atomic_store_n(&entry->handler, cpu_handlers[opcode], __ATOMIC_RELEASE);
+
+		decode_stats->misses++;
+	}
+
+	pthread_mutex_unlock(&decode_cache->lock);
+}
+
+// Runs the instruction at pc >= $8000 from the decode cache, decoding it on
+// first use. Returns 0 if the interpreter has to take it instead.
+static inline uint8_t execute_decoded()
+{
+	struct Decoded_Instruction* entry = &decode_cache->entries[cpu.pc & 0x7FFF];
+	cpu_handler handler = __atomic_load_n(&entry->handler, __ATOMIC_ACQUIRE);
+
+	if (handler == NULL)
+	{
+		uint8_t length = cpu_lengths[prg_memory[cpu.pc & 0x7FFF]];
+
+		// unknown opcodes, and operands wrapping past $FFFF
+		if (length == 0 || cpu.pc + length > 0x10000)
+			return 0;
+
+		decode(entry);
+		handler = entry->handler;
+	}
+
+	uint8_t count = handler(entry->operand, entry->next);
+
+	if (count != 0)
+		decode_stats->hits++;
+	else
+		decode_stats->fallbacks++;
+
+	return count;
+}
+
+#define INTERPRET(code, fn, mode) 		case code: fn(mode()); break;
+#define INTERPRET_IMPLIED(code, fn) 		case code: fn(); break;
+
 void cpu_clock()
 {
-	if (cycles == 0) 
+	// the rest of the instruction that started the DMA runs afterwards
+	if (cpu.dma_cycles != 0)
+	{
+		cpu.dma_cycles--;
+		return;
+	}
+
+	if (cpu.cycles == 0) 
 	{
-		uint8_t opcode = cpu_read(pc);
-		//debug();
-		pc++;
-		
-		switch (opcode)
+		uint16_t start = cpu.pc;
+
+		if (idle->enabled && trace == NULL && (cpu.cycles = idle_check()) != 0)
+			STAT_COUNT(idle_stalls);
+
+		if (cpu.cycles == 0 && jit != NULL && (cpu.cycles = jit_execute()) != 0)
+			STAT_COUNT(jit_blocks);
+
+		if (cpu.cycles == 0)
 		{
-			case 0x69: adc(immediate());	break;
-			case 0x65: adc(zeropage());  	break;
-			case 0x75: adc(zeropagex());	break;
-			case 0x6d: adc(absolute());	break;
-			case 0x7d: adc(absolutex());	break;
-			case 0x79: adc(absolutey());	break;
-			case 0x61: adc(indirectx());	break;
-			case 0x71: adc(indirecty());	break;
-
-			case 0x29: and(immediate());	break;
-			case 0x25: and(zeropage());	break;
-			case 0x35: and(zeropagex());	break;
-			case 0x2d: and(absolute());	break;
-			case 0x3d: and(absolutex());	break;
-			case 0x39: and(absolutey());	break;
-			case 0x21: and(indirectx());	break;
-			case 0x31: and(indirecty());	break;
-
-			case 0x0a: asl_a();		break;
-			case 0x06: asl_m(zeropage());	break;
-			case 0x16: asl_m(zeropagex());	break;
-			case 0x0e: asl_m(absolute());	break;
-			case 0x1e: asl_m(absolutex());	break;
-
-			case 0x90: bcc(relative());	break;
-			case 0xb0: bcs(relative());	break;
-			case 0xf0: beq(relative());	break;
-			case 0x30: bmi(relative());	break;
-			case 0xd0: bne(relative());	break;
-			case 0x10: bpl(relative());	break;
-
-			case 0x24: bit(zeropage());	break;
-			case 0x2c: bit(absolute());	break;
-
-			case 0x00: brk();		break;
-
-			case 0x50: bvc(relative());	break;
-			case 0x70: bvs(relative());	break;
-
-			case 0x18: clc();		break;
-			case 0xd8: cld();		break;
-			case 0x58: cli();		break;
-			case 0xb8: clv();		break;
-
-			case 0xc9: cmp(immediate());	break;
-			case 0xc5: cmp(zeropage());	break;
-			case 0xd5: cmp(zeropagex());	break;
-			case 0xcd: cmp(absolute());	break;
-			case 0xdd: cmp(absolutex());	break;
-			case 0xd9: cmp(absolutey());	break;
-			case 0xc1: cmp(indirectx());	break;
-			case 0xd1: cmp(indirecty());	break;
-
-			case 0xe0: cpx(immediate());	break;
-			case 0xe4: cpx(zeropage());	break;
-			case 0xec: cpx(absolute());	break;
-
-			case 0xc0: cpy(immediate());	break;
-			case 0xc4: cpy(zeropage());	break;
-			case 0xcc: cpy(absolute());	break;
-
-			case 0xc6: dec(zeropage());	break;
-			case 0xd6: dec(zeropagex());	break;
-			case 0xce: dec(absolute());	break;
-			case 0xde: dec(absolutex());	break;
-
-			case 0xca: dex();		break;
-			case 0x88: dey();		break;
-
-			case 0x49: eor(immediate());	break;
-			case 0x45: eor(zeropage());	break;
-			case 0x55: eor(zeropagex());	break;
-			case 0x4d: eor(absolute());	break;
-			case 0x5d: eor(absolutex());	break;
-			case 0x59: eor(absolutey());	break;
-			case 0x41: eor(indirectx());	break;
-			case 0x51: eor(indirecty());	break;
-
-			case 0xe6: inc(zeropage());	break;
-			case 0xf6: inc(zeropagex());	break;
-			case 0xee: inc(absolute());	break;
-			case 0xfe: inc(absolutex());	break;
-
-			case 0xe8: inx();		break;
-			case 0xc8: iny();		break;
-
-			case 0x4c: jmp(absolute());	break;
-			case 0x6c: jmp(indirect());	break;
-
-			case 0x20: jsr(absolute());	break;
-
-			case 0xa9: lda(immediate());	break;
-			case 0xa5: lda(zeropage());	break;
-			case 0xb5: lda(zeropagex());	break;
-			case 0xad: lda(absolute());	break;
-			case 0xbd: lda(absolutex());	break;
-			case 0xb9: lda(absolutey());	break;
-			case 0xa1: lda(indirectx());	break;
-			case 0xb1: lda(indirecty());	break;
-
-			case 0xa2: ldx(immediate());	break;
-			case 0xa6: ldx(zeropage());	break;
-			case 0xb6: ldx(zeropagey());	break;
-			case 0xae: ldx(absolute());	break;
-			case 0xbe: ldx(absolutey());	break;
-
-			case 0xa0: ldy(immediate());	break;
-			case 0xa4: ldy(zeropage());	break;
-			case 0xb4: ldy(zeropagex());	break;
-			case 0xac: ldy(absolute());	break;
-			case 0xbc: ldy(absolutex());	break;
-
-			case 0x4a: lsr_a();		break;
-			case 0x46: lsr_m(zeropage());	break;
-			case 0x56: lsr_m(zeropagex());	break;
-			case 0x4e: lsr_m(absolute());	break;
-			case 0x5e: lsr_m(absolutex());	break;
-
-			case 0x80: nop(immediate());	break;
-			case 0x04:
-			case 0x44: 
-			case 0x64: nop(zeropage());	break;
-			case 0x0c: nop(absolute());	break;
-			case 0x14: 
-			case 0x34: 
-			case 0x54: 
-			case 0x74: 
-			case 0xd4: 
-			case 0xf4: nop(zeropagex());	break;
-			case 0x1a: 
-			case 0x3a: 
-			case 0x5a: 
-			case 0x7a: 
-			case 0xda: 
-			case 0xea: 
-			case 0xfa: nop();		break;
-
-			case 0x1c: 
-			case 0x3c: 
-			case 0x5c: 
-			case 0x7c: 
-			case 0xdc: 
-			case 0xfc: nop(absolutex());	break;
-
-			case 0x09: ora(immediate());	break;
-			case 0x05: ora(zeropage());	break;
-			case 0x15: ora(zeropagex());	break;
-			case 0x0d: ora(absolute());	break;
-			case 0x1d: ora(absolutex());	break;
-			case 0x19: ora(absolutey());	break;
-			case 0x01: ora(indirectx());	break;
-			case 0x11: ora(indirecty());	break;
-
-			case 0x48: pha(); 		break;
-			case 0x08: php(); 		break;
-			case 0x68: pla(); 		break;
-			case 0x28: plp(); 		break;
-
-			case 0x2a: rol_a();		break;
-			case 0x26: rol_m(zeropage());	break;
-			case 0x36: rol_m(zeropagex());	break;
-			case 0x2e: rol_m(absolute());	break;
-			case 0x3e: rol_m(absolutex());	break;
-
-			case 0x6a: ror_a();		break;
-			case 0x66: ror_m(zeropage());	break;
-			case 0x76: ror_m(zeropagex());	break;
-			case 0x6e: ror_m(absolute());	break;
-			case 0x7e: ror_m(absolutex());	break;
-
-			case 0x40: rti(); 		break;
-
-			case 0x60: rts(); 		break;
-
-			case 0xe9: sbc(immediate()); 	break;
-			case 0xe5: sbc(zeropage()); 	break;
-			case 0xf5: sbc(zeropagex()); 	break;
-			case 0xed: sbc(absolute()); 	break;
-			case 0xfd: sbc(absolutex()); 	break;
-			case 0xf9: sbc(absolutey()); 	break;
-			case 0xe1: sbc(indirectx()); 	break;
-			case 0xf1: sbc(indirecty()); 	break;
-
-			case 0x38: sec(); 		break;
-			case 0xf8: sed(); 		break;
-
-			case 0x78: sei(); 		break;
-
-			case 0x85: sta(zeropage()); 	break;
-			case 0x95: sta(zeropagex()); 	break;
-			case 0x8d: sta(absolute()); 	break;
-			case 0x9d: sta(absolutex()); 	break;
-			case 0x99: sta(absolutey()); 	break;
-			case 0x81: sta(indirectx()); 	break;
-			case 0x91: sta(indirecty()); 	break;
-
-			case 0x86: stx(zeropage());	break;
-			case 0x96: stx(zeropagey());	break;
-			case 0x8e: stx(absolute());	break;
-
-			case 0x84: sty(zeropage()); 	break;
-			case 0x94: sty(zeropagex());	break;
-			case 0x8c: sty(absolute());	break;
-
-			case 0xaa: tax(); 		break;
-			case 0xa8: tay(); 		break;
-			case 0xba: tsx(); 		break;
-			case 0x8a: txa(); 		break;
-			case 0x9a: txs(); 		break;
-			case 0x98: tya(); 		break;
-
-			default: 
-				printf("ILLEGAL OPCODE: %X\n", opcode);
-				exit(1);
-				break;
-		}
+			TRACE_INSTRUCTION(cpu.pc);
 
-		cycles += lut_cycles[opcode];
+#ifndef NESEMU_NO_PREDECODE
+			if (cpu.pc >= 0x8000 && (cpu.cycles = execute_decoded()) != 0)
+				STAT_COUNT(predecoded);
+#endif
+		}
 
-		if (page_crossed)
+		if (cpu.cycles == 0)
 		{
-			if (lut_pagecrosses[opcode])
+			STAT_COUNT(interpreted);
+
+			uint8_t opcode = cpu_read(cpu.pc);
+			cpu.pc++;
+
+			switch (opcode)
 			{
-				cycles++;
+				CPU_OPCODES(INTERPRET, INTERPRET_IMPLIED)
+
+				default: 
+					if (cpu_illegal_exit)
+					{
+						printf("ILLEGAL OPCODE: %X\n", opcode);
+						exit(1);
+					}
+
+					// otherwise the CPU locks up on it, as on a 6502 KIL
+					cpu.pc--;
+					break;
 			}
-			page_crossed = false;
+
+			cpu.cycles += instruction_cycles(opcode);
 		}
 
-		counter += cycles;
+		cpu.counter += cpu.cycles;
+
+		// with any OAM DMA it started
+		PROFILE_INSTRUCTION(start, cpu.cycles + cpu.dma_cycles);
 	}
 
-	cycles--;
+	cpu.cycles--;
 }
 
+size_t cpu_save_state(uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	SAVE_STATE(buffer, offset, cpu);
+
+	return offset;
+}
+
+size_t cpu_load_state(const uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	LOAD_STATE(buffer, offset, cpu);
+
+	return offset;
+}
@@ -1,5 +1,9 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "console.h"
 
 #define FLAG_C (1 << 0) // Carry
 #define FLAG_Z (1 << 1)	// Zero
@@ -16,7 +20,7 @@
 
 static const uint8_t lut_cycles[256] = {
 /*      0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F */
-/*0*/	0, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
+/*0*/	7, 6, 2, 8, 3, 3, 5, 5, 3, 2, 2, 2, 4, 4, 6, 6,
 /*1*/	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
 /*2*/	6, 6, 2, 8, 3, 3, 5, 5, 4, 2, 2, 2, 4, 4, 6, 6,
 /*3*/	2, 5, 2, 8, 4, 4, 6, 6, 2, 4, 2, 7, 4, 4, 7, 7,
@@ -55,21 +59,69 @@ static const int lut_pagecrosses[256] = {
 };
 
 
-//extern uint16_t 	pc;
-//extern uint8_t 		opcode;
-//extern uint32_t 	counter;
+// Everything an instruction touches besides memory, on one cache line of
+// its own: the registers and the cycle bookkeeping around them.
+struct CPU
+{
+	uint8_t 	a;
+	uint8_t 	x;
+	uint8_t 	y;
+	uint8_t 	p;
+	uint8_t 	sp;
+	bool 		page_crossed;
+	uint8_t 	cycles;		// left in the current instruction
+	uint16_t 	pc;
+	uint16_t 	dma_cycles;	// the CPU is halted for while OAM DMA runs
+	uint32_t 	counter;
+} __attribute__((aligned(64)));
+
+extern CONSOLE_LOCAL struct CPU 	cpu;
+
+// Whether an unknown opcode ends the process; for the whole process
+extern bool 	cpu_illegal_exit;
+
+// Runs one already-decoded instruction; see HANDLER in cpu.c.
+typedef uint8_t (*cpu_handler)(uint16_t operand, uint16_t next);
+
+extern const cpu_handler 	cpu_handlers[256];
+extern const uint8_t 		cpu_lengths[256];	// 0 for opcodes the CPU does not know
+
+// PRG-ROM instructions decoded the first time they run, indexed by address
+// & 0x7FFF. An entry is empty while handler is NULL.
+struct Decoded_Instruction
+{
+	cpu_handler 	handler;
+	uint16_t 	operand;
+	uint16_t 	next;
+};
 
-struct 		CPU_Registers
+// Derived only from PRG, so consoles sharing a cartridge share one, like the
+// JIT's blocks: entries are filled under the lock and published by storing
+// handler last.
+struct Decode_Cache
 {
-	uint8_t a;
-	uint8_t x;
-	uint8_t y;
-	uint8_t p;
-	uint8_t sp;
+	struct Decoded_Instruction 	entries[0x8000];
+	pthread_mutex_t 		lock;
 };
 
+// each console's own use of the cache
+struct Decode_Stats
+{
+	uint64_t 	hits;		// instructions run from an entry
+	uint64_t 	misses;		// entries filled
+	uint64_t 	fallbacks;	// I/O accesses handed back to the interpreter
+};
+
+extern CONSOLE_LOCAL struct Decode_Cache* 	decode_cache;
+extern CONSOLE_LOCAL struct Decode_Stats* 	decode_stats;
+
 void cpu_clock();
 void cpu_reset();
+void cpu_flush_decode_cache();
 void nmi();
+void irq();
+
+size_t cpu_save_state(uint8_t* buffer);
+size_t cpu_load_state(const uint8_t* buffer);
 
 
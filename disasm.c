@@ -0,0 +1,78 @@
+#include <stdio.h>
+
+#include "disasm.h"
+
+const struct Opcode_Info opcode_info[256] = {
+/*0*/	{ "BRK", Mode_IMP }, { "ORA", Mode_IZX }, { "???", Mode_IMP }, { "*SLO", Mode_IZX }, { "*NOP", Mode_ZP }, { "ORA", Mode_ZP }, { "ASL", Mode_ZP }, { "*SLO", Mode_ZP },
+	{ "PHP", Mode_IMP }, { "ORA", Mode_IMM }, { "ASL", Mode_ACC }, { "???", Mode_IMP }, { "*NOP", Mode_ABS }, { "ORA", Mode_ABS }, { "ASL", Mode_ABS }, { "*SLO", Mode_ABS },
+/*1*/	{ "BPL", Mode_REL }, { "ORA", Mode_IZY }, { "???", Mode_IMP }, { "*SLO", Mode_IZY }, { "*NOP", Mode_ZPX }, { "ORA", Mode_ZPX }, { "ASL", Mode_ZPX }, { "*SLO", Mode_ZPX },
+	{ "CLC", Mode_IMP }, { "ORA", Mode_ABY }, { "*NOP", Mode_IMP }, { "*SLO", Mode_ABY }, { "*NOP", Mode_ABX }, { "ORA", Mode_ABX }, { "ASL", Mode_ABX }, { "*SLO", Mode_ABX },
+/*2*/	{ "JSR", Mode_ABS }, { "AND", Mode_IZX }, { "???", Mode_IMP }, { "*RLA", Mode_IZX }, { "BIT", Mode_ZP }, { "AND", Mode_ZP }, { "ROL", Mode_ZP }, { "*RLA", Mode_ZP },
+	{ "PLP", Mode_IMP }, { "AND", Mode_IMM }, { "ROL", Mode_ACC }, { "???", Mode_IMP }, { "BIT", Mode_ABS }, { "AND", Mode_ABS }, { "ROL", Mode_ABS }, { "*RLA", Mode_ABS },
+/*3*/	{ "BMI", Mode_REL }, { "AND", Mode_IZY }, { "???", Mode_IMP }, { "*RLA", Mode_IZY }, { "*NOP", Mode_ZPX }, { "AND", Mode_ZPX }, { "ROL", Mode_ZPX }, { "*RLA", Mode_ZPX },
+	{ "SEC", Mode_IMP }, { "AND", Mode_ABY }, { "*NOP", Mode_IMP }, { "*RLA", Mode_ABY }, { "*NOP", Mode_ABX }, { "AND", Mode_ABX }, { "ROL", Mode_ABX }, { "*RLA", Mode_ABX },
+/*4*/	{ "RTI", Mode_IMP }, { "EOR", Mode_IZX }, { "???", Mode_IMP }, { "*SRE", Mode_IZX }, { "*NOP", Mode_ZP }, { "EOR", Mode_ZP }, { "LSR", Mode_ZP }, { "*SRE", Mode_ZP },
+	{ "PHA", Mode_IMP }, { "EOR", Mode_IMM }, { "LSR", Mode_ACC }, { "???", Mode_IMP }, { "JMP", Mode_ABS }, { "EOR", Mode_ABS }, { "LSR", Mode_ABS }, { "*SRE", Mode_ABS },
+/*5*/	{ "BVC", Mode_REL }, { "EOR", Mode_IZY }, { "???", Mode_IMP }, { "*SRE", Mode_IZY }, { "*NOP", Mode_ZPX }, { "EOR", Mode_ZPX }, { "LSR", Mode_ZPX }, { "*SRE", Mode_ZPX },
+	{ "CLI", Mode_IMP }, { "EOR", Mode_ABY }, { "*NOP", Mode_IMP }, { "*SRE", Mode_ABY }, { "*NOP", Mode_ABX }, { "EOR", Mode_ABX }, { "LSR", Mode_ABX }, { "*SRE", Mode_ABX },
+/*6*/	{ "RTS", Mode_IMP }, { "ADC", Mode_IZX }, { "???", Mode_IMP }, { "*RRA", Mode_IZX }, { "*NOP", Mode_ZP }, { "ADC", Mode_ZP }, { "ROR", Mode_ZP }, { "*RRA", Mode_ZP },
+	{ "PLA", Mode_IMP }, { "ADC", Mode_IMM }, { "ROR", Mode_ACC }, { "???", Mode_IMP }, { "JMP", Mode_IND }, { "ADC", Mode_ABS }, { "ROR", Mode_ABS }, { "*RRA", Mode_ABS },
+/*7*/	{ "BVS", Mode_REL }, { "ADC", Mode_IZY }, { "???", Mode_IMP }, { "*RRA", Mode_IZY }, { "*NOP", Mode_ZPX }, { "ADC", Mode_ZPX }, { "ROR", Mode_ZPX }, { "*RRA", Mode_ZPX },
+	{ "SEI", Mode_IMP }, { "ADC", Mode_ABY }, { "*NOP", Mode_IMP }, { "*RRA", Mode_ABY }, { "*NOP", Mode_ABX }, { "ADC", Mode_ABX }, { "ROR", Mode_ABX }, { "*RRA", Mode_ABX },
+/*8*/	{ "*NOP", Mode_IMM }, { "STA", Mode_IZX }, { "*NOP", Mode_IMM }, { "*SAX", Mode_IZX }, { "STY", Mode_ZP }, { "STA", Mode_ZP }, { "STX", Mode_ZP }, { "*SAX", Mode_ZP },
+	{ "DEY", Mode_IMP }, { "*NOP", Mode_IMM }, { "TXA", Mode_IMP }, { "???", Mode_IMP }, { "STY", Mode_ABS }, { "STA", Mode_ABS }, { "STX", Mode_ABS }, { "*SAX", Mode_ABS },
+/*9*/	{ "BCC", Mode_REL }, { "STA", Mode_IZY }, { "???", Mode_IMP }, { "???", Mode_IMP }, { "STY", Mode_ZPX }, { "STA", Mode_ZPX }, { "STX", Mode_ZPY }, { "*SAX", Mode_ZPY },
+	{ "TYA", Mode_IMP }, { "STA", Mode_ABY }, { "TXS", Mode_IMP }, { "???", Mode_IMP }, { "???", Mode_IMP }, { "STA", Mode_ABX }, { "???", Mode_IMP }, { "???", Mode_IMP },
+/*A*/	{ "LDY", Mode_IMM }, { "LDA", Mode_IZX }, { "LDX", Mode_IMM }, { "*LAX", Mode_IZX }, { "LDY", Mode_ZP }, { "LDA", Mode_ZP }, { "LDX", Mode_ZP }, { "*LAX", Mode_ZP },
+	{ "TAY", Mode_IMP }, { "LDA", Mode_IMM }, { "TAX", Mode_IMP }, { "???", Mode_IMP }, { "LDY", Mode_ABS }, { "LDA", Mode_ABS }, { "LDX", Mode_ABS }, { "*LAX", Mode_ABS },
+/*B*/	{ "BCS", Mode_REL }, { "LDA", Mode_IZY }, { "???", Mode_IMP }, { "*LAX", Mode_IZY }, { "LDY", Mode_ZPX }, { "LDA", Mode_ZPX }, { "LDX", Mode_ZPY }, { "*LAX", Mode_ZPY },
+	{ "CLV", Mode_IMP }, { "LDA", Mode_ABY }, { "TSX", Mode_IMP }, { "???", Mode_IMP }, { "LDY", Mode_ABX }, { "LDA", Mode_ABX }, { "LDX", Mode_ABY }, { "*LAX", Mode_ABY },
+/*C*/	{ "CPY", Mode_IMM }, { "CMP", Mode_IZX }, { "*NOP", Mode_IMM }, { "*DCP", Mode_IZX }, { "CPY", Mode_ZP }, { "CMP", Mode_ZP }, { "DEC", Mode_ZP }, { "*DCP", Mode_ZP },
+	{ "INY", Mode_IMP }, { "CMP", Mode_IMM }, { "DEX", Mode_IMP }, { "???", Mode_IMP }, { "CPY", Mode_ABS }, { "CMP", Mode_ABS }, { "DEC", Mode_ABS }, { "*DCP", Mode_ABS },
+/*D*/	{ "BNE", Mode_REL }, { "CMP", Mode_IZY }, { "???", Mode_IMP }, { "*DCP", Mode_IZY }, { "*NOP", Mode_ZPX }, { "CMP", Mode_ZPX }, { "DEC", Mode_ZPX }, { "*DCP", Mode_ZPX },
+	{ "CLD", Mode_IMP }, { "CMP", Mode_ABY }, { "*NOP", Mode_IMP }, { "*DCP", Mode_ABY }, { "*NOP", Mode_ABX }, { "CMP", Mode_ABX }, { "DEC", Mode_ABX }, { "*DCP", Mode_ABX },
+/*E*/	{ "CPX", Mode_IMM }, { "SBC", Mode_IZX }, { "*NOP", Mode_IMM }, { "*ISB", Mode_IZX }, { "CPX", Mode_ZP }, { "SBC", Mode_ZP }, { "INC", Mode_ZP }, { "*ISB", Mode_ZP },
+	{ "INX", Mode_IMP }, { "SBC", Mode_IMM }, { "NOP", Mode_IMP }, { "*SBC", Mode_IMM }, { "CPX", Mode_ABS }, { "SBC", Mode_ABS }, { "INC", Mode_ABS }, { "*ISB", Mode_ABS },
+/*F*/	{ "BEQ", Mode_REL }, { "SBC", Mode_IZY }, { "???", Mode_IMP }, { "*ISB", Mode_IZY }, { "*NOP", Mode_ZPX }, { "SBC", Mode_ZPX }, { "INC", Mode_ZPX }, { "*ISB", Mode_ZPX },
+	{ "SED", Mode_IMP }, { "SBC", Mode_ABY }, { "*NOP", Mode_IMP }, { "*ISB", Mode_ABY }, { "*NOP", Mode_ABX }, { "SBC", Mode_ABX }, { "INC", Mode_ABX }, { "*ISB", Mode_ABX }
+};
+
+static const uint8_t lut_length[] = {
+	[Mode_IMP] = 1, [Mode_ACC] = 1, [Mode_IMM] = 2,
+	[Mode_ZP] = 2, [Mode_ZPX] = 2, [Mode_ZPY] = 2,
+	[Mode_ABS] = 3, [Mode_ABX] = 3, [Mode_ABY] = 3, [Mode_IND] = 3,
+	[Mode_IZX] = 2, [Mode_IZY] = 2, [Mode_REL] = 2
+};
+
+uint8_t disasm_length(uint8_t opcode)
+{
+	return lut_length[opcode_info[opcode].mode];
+}
+
+// Formats the instruction starting at bytes[0] the way nestest.log does,
+// minus the memory annotations: "JMP $C5F5", "LDA ($80),Y". The name keeps
+// its leading '*' for unofficial opcodes.
+int disasm(char* out, size_t size, uint16_t pc, const uint8_t* bytes)
+{
+	const struct Opcode_Info* info = &opcode_info[bytes[0]];
+	uint16_t word = bytes[1] | (bytes[2] << 8);
+
+	switch (info->mode)
+	{
+		case Mode_IMP: return snprintf(out, size, "%s", info->name);
+		case Mode_ACC: return snprintf(out, size, "%s A", info->name);
+		case Mode_IMM: return snprintf(out, size, "%s #$%02X", info->name, bytes[1]);
+		case Mode_ZP:  return snprintf(out, size, "%s $%02X", info->name, bytes[1]);
+		case Mode_ZPX: return snprintf(out, size, "%s $%02X,X", info->name, bytes[1]);
+		case Mode_ZPY: return snprintf(out, size, "%s $%02X,Y", info->name, bytes[1]);
+		case Mode_ABS: return snprintf(out, size, "%s $%04X", info->name, word);
+		case Mode_ABX: return snprintf(out, size, "%s $%04X,X", info->name, word);
+		case Mode_ABY: return snprintf(out, size, "%s $%04X,Y", info->name, word);
+		case Mode_IND: return snprintf(out, size, "%s ($%04X)", info->name, word);
+		case Mode_IZX: return snprintf(out, size, "%s ($%02X,X)", info->name, bytes[1]);
+		case Mode_IZY: return snprintf(out, size, "%s ($%02X),Y", info->name, bytes[1]);
+		case Mode_REL: return snprintf(out, size, "%s $%04X", info->name, (uint16_t)(pc + 2 + (int8_t)bytes[1]));
+	}
+
+	return 0;
+}
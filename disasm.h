@@ -0,0 +1,21 @@
+#include <stdint.h>
+#include <stddef.h>
+
+enum address_mode
+{
+	Mode_IMP, Mode_ACC, Mode_IMM,
+	Mode_ZP, Mode_ZPX, Mode_ZPY,
+	Mode_ABS, Mode_ABX, Mode_ABY, Mode_IND,
+	Mode_IZX, Mode_IZY, Mode_REL
+};
+
+struct Opcode_Info
+{
+	const char* 		name;	// unofficial opcodes are starred, as in nestest
+	enum address_mode 	mode;
+};
+
+extern const struct Opcode_Info opcode_info[256];
+
+uint8_t 	disasm_length(uint8_t opcode);
+int 		disasm(char* out, size_t size, uint16_t pc, const uint8_t* bytes);
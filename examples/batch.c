@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../nes.h"
+#include "../bench.h"
+
+// Reports aggregate frames/s for growing batches of consoles running one ROM.
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: batch <rom> [max consoles] [frames]\n");
+		return 1;
+	}
+
+	int max_count = argc > 2 ? atoi(argv[2]) : 64;
+	int frames = argc > 3 ? atoi(argv[3]) : 600;
+	int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+	printf("%8s %8s %12s %14s\n", "consoles", "threads", "frames/s", "per console");
+
+	for (int count = 1; count <= max_count; count *= 2)
+	{
+		int threads = count < cores ? count : cores;
+
+		nes_batch_t* batch = nes_batch_create(argv[1], count, threads);
+		if (batch == NULL)
+		{
+			printf("Cannot load %s\n", argv[1]);
+			return 1;
+		}
+
+		uint8_t* inputs = malloc(count * NES_PORTS);
+		srand(count);
+
+		double start = seconds();
+
+		for (int frame = 0; frame < frames; frame++)
+		{
+			for (int i = 0; i < count * NES_PORTS; i++)
+				inputs[i] = rand() & 0xFF;
+
+			nes_batch_step_frame(batch, inputs);
+		}
+
+		double rate = (double)count * frames / (seconds() - start);
+		printf("%8d %8d %12.1f %14.1f\n", count, threads, rate, rate / count);
+
+		free(inputs);
+		nes_batch_destroy(batch);
+	}
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../nes.h"
+#include "../filter.h"
+#include "../bench.h"
+
+// Runs every presentation filter with every instruction set this host has
+// over one frame, reporting output megapixels/s. The frame is from a ROM
+// after 300 frames if one is given, or 8x8 blocks of random colours. Each
+// SIMD kernel must produce exactly what the scalar one does.
+
+int main(int argc, char *argv[])
+{
+	static uint8_t screen[FILTER_WIDTH * FILTER_HEIGHT * 3];
+
+	if (argc > 1)
+	{
+		nes_t* nes = nes_create();
+		if (nes == NULL || nes_load_rom(nes, argv[1]) != 0)
+		{
+			printf("Cannot load %s\n", argv[1]);
+			return 1;
+		}
+
+		for (int i = 0; i < 300; i++)
+			nes_step_frame(nes);
+
+		memcpy(screen, nes_get_framebuffer(nes), sizeof(screen));
+		nes_destroy(nes);
+	}
+	else
+	{
+		srand(1);
+		for (int y = 0; y < FILTER_HEIGHT; y += 8)
+		{
+			for (int x = 0; x < FILTER_WIDTH; x += 8)
+			{
+				uint8_t r = rand() & 0xC0, g = rand() & 0xC0, b = rand() & 0xC0;
+
+				for (int i = 0; i < 64; i++)
+				{
+					uint8_t* pixel = &screen[((y + i / 8) * FILTER_WIDTH + x + i % 8) * 3];
+					pixel[0] = r, pixel[1] = g, pixel[2] = b;
+				}
+			}
+		}
+	}
+
+	uint32_t* output = malloc(FILTER_WIDTH * FILTER_HEIGHT * 16 * sizeof(uint32_t));
+	int result = 0;
+
+	for (int filter = 0; filter < FILTERS; filter++)
+	{
+		size_t pixels = FILTER_WIDTH * FILTER_HEIGHT * filters[filter].scale * filters[filter].scale;
+		uint32_t reference = 0;
+
+		for (int isa = 0; isa < ISAS; isa++)
+		{
+			if (filter_set_isa(isa) != 0)
+				continue;
+
+			int runs = 0;
+			double start = seconds(), elapsed;
+
+			do
+			{
+				filter_apply(filter, screen, output);
+				runs++;
+			}
+			while ((elapsed = seconds() - start) < 0.25);
+
+			uint32_t sum = checksum((const uint8_t*)output, pixels * sizeof(uint32_t));
+
+			if (isa == ISA_Scalar)
+				reference = sum;
+
+			int same = sum == reference;
+			result |= !same;
+
+			printf("%-8s %-7s %8.1f Mpixels/s  %s\n", filters[filter].name, filter_isa_names[isa],
+			       pixels * runs / elapsed / 1e6, same ? "same" : "DIFFERS");
+		}
+	}
+
+	free(output);
+
+	return result;
+}
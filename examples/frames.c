@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../nes.h"
+#include "../bench.h"
+
+// Steps a ROM headless with pseudo-random input, then rewinds to a snapshot
+// and replays the same input to show the run is reproducible.
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: frames <rom> [frames] [jit]\n");
+		return 1;
+	}
+
+	int frames = argc > 2 ? atoi(argv[2]) : 3600;
+
+	nes_t* nes = nes_create();
+	if (nes == NULL || nes_load_rom(nes, argv[1]) != 0)
+	{
+		printf("Cannot load %s\n", argv[1]);
+		return 1;
+	}
+
+	if (argc > 3 && strcmp(argv[3], "jit") == 0 && nes_set_jit(nes, 1) != 0)
+		printf("No JIT on this platform, interpreting\n");
+
+	size_t state_size = nes_state_size();
+	uint8_t* state = malloc(state_size);
+
+	uint8_t* inputs = malloc(frames);
+	srand(1);
+	for (int i = 0; i < frames; i++)
+		inputs[i] = rand() & 0xFF;
+
+	double start = seconds();
+
+	for (int i = 0; i < frames; i++)
+	{
+		if (i == frames / 2)
+			nes_save_state(nes, state, state_size);
+
+		nes_set_input(nes, 0, inputs[i]);
+		nes_step_frame(nes);
+	}
+
+	double elapsed = seconds() - start;
+
+	uint32_t ram = checksum(nes_get_ram(nes), NES_RAM_SIZE);
+	uint32_t video = checksum(nes_get_framebuffer(nes), NES_WIDTH * NES_HEIGHT * 3);
+
+	printf("%d frames in %.3fs (%.1f frames/s)\n", frames, elapsed, frames / elapsed);
+	printf("ram %08X  framebuffer %08X\n", ram, video);
+
+	nes_decode_stats_t decode;
+	nes_get_decode_stats(nes, &decode);
+
+	uint64_t decoded = decode.hits + decode.fallbacks;
+	if (decoded != 0)
+		printf("decode cache: %.2f%% hits, %llu entries, %.2f%% handed back for I/O\n",
+		       100.0 * decode.hits / decoded, (unsigned long long)decode.misses,
+		       100.0 * decode.fallbacks / decoded);
+
+	nes_idle_stats_t idle;
+	nes_get_idle_stats(nes, &idle);
+
+	if (idle.total_cycles != 0)
+		printf("idle loops: %.2f%% of cycles skipped in %llu stalls\n",
+		       100.0 * idle.skipped_cycles / idle.total_cycles, (unsigned long long)idle.skips);
+
+	nes_stats_t stats;
+
+	// only with -DNESEMU_STATS
+	if (nes_get_stats(nes, &stats) == 0 && stats.frame_seconds > 0)
+		printf("sound synthesis: %.1f%% of frame time\n", 100.0 * stats.apu_seconds / stats.frame_seconds);
+
+	nes_load_state(nes, state, state_size);
+
+	for (int i = frames / 2; i < frames; i++)
+	{
+		nes_set_input(nes, 0, inputs[i]);
+		nes_step_frame(nes);
+	}
+
+	int replayed = checksum(nes_get_ram(nes), NES_RAM_SIZE) == ram &&
+		       checksum(nes_get_framebuffer(nes), NES_WIDTH * NES_HEIGHT * 3) == video;
+
+	printf("replay from snapshot %s\n", replayed ? "matches" : "DIVERGED");
+
+	free(inputs);
+	free(state);
+	nes_destroy(nes);
+
+	return replayed ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../nes.h"
+#include "../bench.h"
+
+// Steps a ROM headless at frame skip factors 1-8 with the same pseudo-random
+// input, reporting frames/s against drawing every frame. The work RAM and the
+// final picture must come out the same at every factor.
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: skip <rom> [frames]\n");
+		return 1;
+	}
+
+	// a multiple of every factor, so the last frame is always drawn
+	int frames = argc > 2 ? atoi(argv[2]) / 840 * 840 : 1680;
+
+	if (frames == 0)
+		frames = 840;
+
+	uint8_t* inputs = malloc(frames);
+	srand(1);
+	for (int i = 0; i < frames; i++)
+		inputs[i] = rand() & 0xFF;
+
+	double base = 0;
+	uint32_t ram = 0, video = 0;
+	int result = 0;
+
+	for (int factor = 1; factor <= 8; factor++)
+	{
+		nes_t* nes = nes_create();
+		if (nes == NULL || nes_load_rom(nes, argv[1]) != 0)
+		{
+			printf("Cannot load %s\n", argv[1]);
+			return 1;
+		}
+
+		nes_set_frame_skip(nes, factor);
+
+		double start = seconds();
+
+		for (int i = 0; i < frames; i++)
+		{
+			nes_set_input(nes, 0, inputs[i]);
+			nes_step_frame(nes);
+		}
+
+		double rate = frames / (seconds() - start);
+
+		uint32_t factor_ram = checksum(nes_get_ram(nes), NES_RAM_SIZE);
+		uint32_t factor_video = checksum(nes_get_framebuffer(nes), NES_WIDTH * NES_HEIGHT * 3);
+
+		if (factor == 1)
+		{
+			base = rate;
+			ram = factor_ram;
+			video = factor_video;
+		}
+
+		int same = factor_ram == ram && factor_video == video;
+		result |= !same;
+
+		printf("skip %d: %7.1f frames/s  %.2fx  %s\n", factor, rate, rate / base, same ? "same" : "DIVERGED");
+
+		nes_destroy(nes);
+	}
+
+	free(inputs);
+
+	return result;
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../nes.h"
+#include "../bench.h"
+
+// Measures PPUDATA uploads during forced blank: a built-in ROM turns
+// rendering off and writes 1 KiB nametables through $2007 forever, counting
+// them in RAM, and is timed once interpreted and once with the JIT.
+
+#define PRG_SIZE 	0x4000
+#define CHR_SIZE 	0x2000
+
+static const uint8_t program[] = {
+	0x78,			// 	sei
+	0xD8,			// 	cld
+	0xA2, 0xFF,		// 	ldx #$FF
+	0x9A,			// 	txs
+	0xA9, 0x00,		// 	lda #$00
+	0x8D, 0x00, 0x20,	// 	sta $2000	; NMI off, increment 1
+	0x8D, 0x01, 0x20,	// 	sta $2001	; rendering off
+	0xA9, 0x20,		// loop:	lda #$20
+	0x8D, 0x06, 0x20,	// 	sta $2006
+	0xA9, 0x00,		// 	lda #$00
+	0x8D, 0x06, 0x20,	// 	sta $2006
+	0xA0, 0x04,		// 	ldy #$04
+	0xA2, 0x00,		// 	ldx #$00
+	0x8E, 0x07, 0x20,	// byte:	stx $2007
+	0xE8,			// 	inx
+	0xD0, 0xFA,		// 	bne byte
+	0x88,			// 	dey
+	0xD0, 0xF7,		// 	bne byte
+	0xE6, 0x10,		// 	inc $10		; uploads, low
+	0xD0, 0xE5,		// 	bne loop
+	0xE6, 0x11,		// 	inc $11		; uploads, high
+	0x4C, 0x0D, 0xC0,	// 	jmp loop
+};
+
+static uint8_t* build_rom(size_t* size)
+{
+	*size = 16 + PRG_SIZE + CHR_SIZE;
+	uint8_t* rom = calloc(1, *size);
+
+	if (rom == NULL)
+		return NULL;
+
+	memcpy(rom, "NES\x1A", 4);
+	rom[4] = PRG_SIZE / 0x4000;
+	rom[5] = CHR_SIZE / 0x2000;
+
+	uint8_t* prg = rom + 16;
+	memcpy(prg, program, sizeof(program));
+
+	// NMI, reset and IRQ all at $C000
+	for (int i = 0x3FFA; i < 0x4000; i += 2)
+	{
+		prg[i] = 0x00;
+		prg[i + 1] = 0xC0;
+	}
+
+	return rom;
+}
+
+static int run(const uint8_t* rom, size_t size, int frames, int use_jit)
+{
+	nes_t* nes = nes_create();
+	if (nes == NULL || nes_load_rom_memory(nes, rom, size) != 0)
+	{
+		printf("Cannot load the upload ROM\n");
+		return 1;
+	}
+
+	if (use_jit && nes_set_jit(nes, 1) != 0)
+	{
+		printf("jit:         not available on this platform\n");
+		nes_destroy(nes);
+		return 0;
+	}
+
+	double start = seconds();
+
+	for (int i = 0; i < frames; i++)
+		nes_step_frame(nes);
+
+	double elapsed = seconds() - start;
+
+	const uint8_t* ram = nes_get_ram(nes);
+	double bytes = (ram[0x10] | ram[0x11] << 8) * 1024.0;
+
+	printf("%-12s %.1f MB in %.3fs, %.2f MB/s host, %.1f KB per emulated frame\n",
+	       use_jit ? "jit:" : "interpreter:", bytes / 1e6, elapsed, bytes / elapsed / 1e6, bytes / frames / 1024);
+
+	nes_destroy(nes);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 600;
+
+	size_t size;
+	uint8_t* rom = build_rom(&size);
+
+	if (rom == NULL)
+		return 1;
+
+	int result = run(rom, size, frames, 0) || run(rom, size, frames, 1);
+
+	free(rom);
+
+	return result;
+}
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "export.h"
+#include "ppu.h"
+#include "memory.h"
+
+CONSOLE_LOCAL struct Export* 	frame_export;
+
+#define SCREEN_SIZE 	(WIDTH * HEIGHT * CHANNELS)
+
+// POSIX wants one leading slash
+static void segment_name(char* buffer, size_t size, const char* name)
+{
+	snprintf(buffer, size, "%s%s", name[0] == '/' ? "" : "/", name);
+}
+
+// Creates (or takes over) the segment and publishes into it after every
+// frame from now on; replaces any export already running.
+int export_start(const char* name)
+{
+	export_stop();
+
+	struct Export* e = calloc(1, sizeof(struct Export));
+
+	if (e == NULL)
+		return 1;
+
+	segment_name(e->name, sizeof(e->name), name);
+	e->size = sizeof(struct Export_Header) + SCREEN_SIZE + EXPORT_RAM_SIZE;
+
+	int fd = shm_open(e->name, O_CREAT | O_RDWR, 0600);
+
+	if (fd < 0 || ftruncate(fd, e->size) != 0)
+	{
+		if (fd >= 0)
+			close(fd);
+		free(e);
+		return 1;
+	}
+
+	e->header = mmap(NULL, e->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (e->header == MAP_FAILED)
+	{
+		shm_unlink(e->name);
+		free(e);
+		return 1;
+	}
+
+	struct Export_Header* h = e->header;
+
+	memset(h, 0, e->size);
+	memcpy(h->id, EXPORT_ID, 4);
+	h->version = EXPORT_VERSION;
+	h->width = WIDTH;
+	h->height = HEIGHT;
+	h->screen_offset = sizeof(struct Export_Header);
+	h->ram_offset = sizeof(struct Export_Header) + SCREEN_SIZE;
+	h->ram_size = EXPORT_RAM_SIZE;
+
+	frame_export = e;
+
+	return 0;
+}
+
+// Readers still mapping the segment keep it until they let go
+void export_destroy(struct Export* e)
+{
+	if (e == NULL)
+		return;
+
+	munmap(e->header, e->size);
+	shm_unlink(e->name);
+
+	free(e);
+}
+
+void export_stop()
+{
+	export_destroy(frame_export);
+	frame_export = NULL;
+}
+
+// The frame just finished and the RAM as it left it, under the seqlock
+void export_publish()
+{
+	struct Export_Header* h = frame_export->header;
+	uint64_t sequence = atomic_load_explicit(&h->sequence, memory_order_relaxed);
+
+	atomic_store_explicit(&h->sequence, sequence + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	memcpy((uint8_t*)h + h->screen_offset, screen, SCREEN_SIZE);
+	memcpy((uint8_t*)h + h->ram_offset, cpu_memory, EXPORT_RAM_SIZE);
+	h->frame++;
+
+	atomic_store_explicit(&h->sequence, sequence + 2, memory_order_release);
+}
+
+// Returns NULL if there is no such segment or it isn't one of ours
+struct Export_Header* export_open(const char* name)
+{
+	char path[64];
+	struct stat info;
+
+	segment_name(path, sizeof(path), name);
+
+	int fd = shm_open(path, O_RDONLY, 0);
+
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(struct Export_Header))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	struct Export_Header* h = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (h == MAP_FAILED)
+		return NULL;
+
+	if (memcmp(h->id, EXPORT_ID, 4) != 0 || h->version != EXPORT_VERSION ||
+	    (size_t)info.st_size < h->ram_offset + h->ram_size)
+	{
+		munmap(h, info.st_size);
+		return NULL;
+	}
+
+	return h;
+}
+
+void export_close(struct Export_Header* header)
+{
+	munmap(header, header->ram_offset + header->ram_size);
+}
+
+// Copies the latest frame and RAM out whole, either of them NULL to skip
+// it, and returns how many frames had been published by then.
+uint64_t export_read(const struct Export_Header* header, uint8_t* screen_copy, uint8_t* ram_copy)
+{
+	uint64_t before, after, frame = 0;
+
+	do
+	{
+		before = atomic_load_explicit(&header->sequence, memory_order_acquire);
+
+		if (before & 1)
+			continue;
+
+		if (screen_copy != NULL)
+			memcpy(screen_copy, (const uint8_t*)header + header->screen_offset, header->width * header->height * 3);
+		if (ram_copy != NULL)
+			memcpy(ram_copy, (const uint8_t*)header + header->ram_offset, header->ram_size);
+		frame = header->frame;
+
+		atomic_thread_fence(memory_order_acquire);
+		after = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+	}
+	while ((before & 1) || before != after);
+
+	return frame;
+}
@@ -0,0 +1,46 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "console.h"
+
+#define EXPORT_ID 	"NESX"
+#define EXPORT_VERSION 	1
+#define EXPORT_RAM_SIZE 0x800
+
+// The start of the shared memory segment, followed by the frame and the
+// work RAM at the offsets given. sequence is odd while a frame is being
+// written: readers copy what they need, then check that it was even and is
+// unchanged, and go again if not (see export_read()).
+struct Export_Header
+{
+	char 			id[4];
+	uint32_t 		version;
+	uint32_t 		width;
+	uint32_t 		height;
+	uint32_t 		screen_offset;	// RGB24, width x height
+	uint32_t 		ram_offset;
+	uint32_t 		ram_size;
+	uint32_t 		reserved;
+	_Atomic uint64_t 	sequence;
+	uint64_t 		frame;		// frames published so far
+};
+
+struct Export
+{
+	struct Export_Header* 	header;
+	size_t 			size;
+	char 			name[64];
+};
+
+extern CONSOLE_LOCAL struct Export* 	frame_export;
+
+int 		export_start(const char* name);
+void 		export_stop();
+void 		export_destroy(struct Export* e);
+void 		export_publish();
+
+// For readers: maps a segment read-only, and copies out a consistent frame
+struct Export_Header* 	export_open(const char* name);
+void 			export_close(struct Export_Header* header);
+uint64_t 		export_read(const struct Export_Header* header, uint8_t* screen, uint8_t* ram);
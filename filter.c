@@ -0,0 +1,440 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "filter.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+const struct Filter_Info filters[FILTERS] = {
+	{ "none", 	1 },
+	{ "nearest", 	4 },
+	{ "scale2x", 	2 },
+	{ "scale3x", 	3 },
+	{ "ntsc", 	2 },
+	{ "crt", 	4 },
+};
+
+const char* const filter_isa_names[ISAS] = { "scalar", "sse2", "avx2" };
+
+#define STRIDE 		(FILTER_WIDTH + 2)
+#define PIXEL(x, y) 	(&source[((y) + 1) * STRIDE + (x) + 1])
+
+// The frame as XRGB8888 with a one pixel border copied from its edges, so
+// every pixel has all eight neighbours
+static uint32_t 	source[(FILTER_HEIGHT + 2) * STRIDE];
+
+// One row at a time; row points into source. widen() repeats each pixel 2
+// or 4 times, bleed() blurs along the row and darken() halves brightness.
+struct Kernels
+{
+	void 	(*widen)(const uint32_t* row, uint32_t* out, int scale);
+	void 	(*bleed)(const uint32_t* row, uint32_t* out);
+	void 	(*darken)(const uint32_t* row, uint32_t* out, size_t count);
+	void 	(*scale2x)(const uint32_t* row, uint32_t* out0, uint32_t* out1);
+	void 	(*scale3x)(const uint32_t* row, uint32_t* out0, uint32_t* out1, uint32_t* out2);
+};
+
+// Rounding average of each byte, as PAVGB
+static inline uint32_t average(uint32_t a, uint32_t b)
+{
+	return (a | b) - (((a ^ b) >> 1) & 0x7F7F7F7F);
+}
+
+static void widen_scalar(const uint32_t* row, uint32_t* out, int scale)
+{
+	for (int x = 0; x < FILTER_WIDTH; x++)
+		for (int i = 0; i < scale; i++)
+			*out++ = row[x];
+}
+
+static void bleed_scalar(const uint32_t* row, uint32_t* out)
+{
+	for (int x = 0; x < FILTER_WIDTH; x++)
+		out[x] = average(row[x], average(row[x - 1], row[x + 1]));
+}
+
+static void darken_scalar(const uint32_t* row, uint32_t* out, size_t count)
+{
+	for (size_t x = 0; x < count; x++)
+		out[x] = (row[x] >> 1) & 0x7F7F7F7F;
+}
+
+// AdvMAME's rules. With B above E, D left, F right and H below, a corner
+// takes the colour of the two edges meeting at it when they match and the
+// opposite ones don't.
+static void scale2x_scalar(const uint32_t* row, uint32_t* out0, uint32_t* out1)
+{
+	for (int x = 0; x < FILTER_WIDTH; x++)
+	{
+		uint32_t b = row[x - STRIDE], d = row[x - 1], e = row[x], f = row[x + 1], h = row[x + STRIDE];
+		bool edge = b != h && d != f;
+
+		out0[2 * x] 	= edge && d == b ? d : e;
+		out0[2 * x + 1] = edge && b == f ? f : e;
+		out1[2 * x] 	= edge && d == h ? d : e;
+		out1[2 * x + 1] = edge && h == f ? f : e;
+	}
+}
+
+static void scale3x_scalar(const uint32_t* row, uint32_t* out0, uint32_t* out1, uint32_t* out2)
+{
+	for (int x = 0; x < FILTER_WIDTH; x++)
+	{
+		uint32_t a = row[x - STRIDE - 1], b = row[x - STRIDE], c = row[x - STRIDE + 1];
+		uint32_t d = row[x - 1], e = row[x], f = row[x + 1];
+		uint32_t g = row[x + STRIDE - 1], h = row[x + STRIDE], i = row[x + STRIDE + 1];
+		bool edge = b != h && d != f;
+
+		bool db = edge && d == b, bf = edge && b == f, dh = edge && d == h, hf = edge && h == f;
+
+		out0[3 * x] 	= db ? d : e;
+		out0[3 * x + 1] = (db && e != c) || (bf && e != a) ? b : e;
+		out0[3 * x + 2] = bf ? f : e;
+		out1[3 * x] 	= (db && e != g) || (dh && e != a) ? d : e;
+		out1[3 * x + 1] = e;
+		out1[3 * x + 2] = (bf && e != i) || (hf && e != c) ? f : e;
+		out2[3 * x] 	= dh ? d : e;
+		out2[3 * x + 1] = (dh && e != i) || (hf && e != g) ? h : e;
+		out2[3 * x + 2] = hf ? f : e;
+	}
+}
+
+#if defined(__x86_64__)
+
+#define LOAD(p) 	_mm_loadu_si128((const __m128i*)(p))
+#define STORE(p, v) 	_mm_storeu_si128((__m128i*)(p), v)
+
+static inline __m128i select128(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// Stores p0 q0 r0 p1 q1 r1 ... p3 q3 r3
+static inline void store3(uint32_t* out, __m128i p, __m128i q, __m128i r)
+{
+	__m128i pq_lo = _mm_unpacklo_epi32(p, q), pq_hi = _mm_unpackhi_epi32(p, q);
+	__m128i qr_lo = _mm_unpacklo_epi32(q, r), qr_hi = _mm_unpackhi_epi32(q, r);
+	__m128i rp_lo = _mm_unpacklo_epi32(r, p), rp_hi = _mm_unpackhi_epi32(r, p);
+
+	STORE(out, _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(pq_lo), _mm_castsi128_ps(rp_lo), _MM_SHUFFLE(3, 0, 1, 0))));
+	STORE(out + 4, _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(qr_lo), _mm_castsi128_ps(pq_hi), _MM_SHUFFLE(1, 0, 3, 2))));
+	STORE(out + 8, _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(rp_hi), _mm_castsi128_ps(qr_hi), _MM_SHUFFLE(3, 2, 3, 0))));
+}
+
+static void widen_sse2(const uint32_t* row, uint32_t* out, int scale)
+{
+	for (int x = 0; x < FILTER_WIDTH; x += 4)
+	{
+		__m128i v = LOAD(row + x);
+
+		if (scale == 2)
+		{
+			STORE(out + 2 * x, _mm_unpacklo_epi32(v, v));
+			STORE(out + 2 * x + 4, _mm_unpackhi_epi32(v, v));
+		}
+		else
+		{
+			STORE(out + 4 * x, _mm_shuffle_epi32(v, 0x00));
+			STORE(out + 4 * x + 4, _mm_shuffle_epi32(v, 0x55));
+			STORE(out + 4 * x + 8, _mm_shuffle_epi32(v, 0xAA));
+			STORE(out + 4 * x + 12, _mm_shuffle_epi32(v, 0xFF));
+		}
+	}
+}
+
+static void bleed_sse2(const uint32_t* row, uint32_t* out)
+{
+	for (int x = 0; x < FILTER_WIDTH; x += 4)
+		STORE(out + x, _mm_avg_epu8(LOAD(row + x), _mm_avg_epu8(LOAD(row + x - 1), LOAD(row + x + 1))));
+}
+
+static void darken_sse2(const uint32_t* row, uint32_t* out, size_t count)
+{
+	const __m128i mask = _mm_set1_epi32(0x7F7F7F7F);
+
+	for (size_t x = 0; x < count; x += 4)
+		STORE(out + x, _mm_and_si128(_mm_srli_epi32(LOAD(row + x), 1), mask));
+}
+
+static void scale2x_sse2(const uint32_t* row, uint32_t* out0, uint32_t* out1)
+{
+	for (int x = 0; x < FILTER_WIDTH; x += 4)
+	{
+		__m128i b = LOAD(row + x - STRIDE), d = LOAD(row + x - 1), e = LOAD(row + x);
+		__m128i f = LOAD(row + x + 1), h = LOAD(row + x + STRIDE);
+
+		__m128i edge = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)), _mm_set1_epi32(-1));
+
+		__m128i e0 = select128(_mm_and_si128(_mm_cmpeq_epi32(d, b), edge), d, e);
+		__m128i e1 = select128(_mm_and_si128(_mm_cmpeq_epi32(b, f), edge), f, e);
+		__m128i e2 = select128(_mm_and_si128(_mm_cmpeq_epi32(d, h), edge), d, e);
+		__m128i e3 = select128(_mm_and_si128(_mm_cmpeq_epi32(h, f), edge), f, e);
+
+		STORE(out0 + 2 * x, _mm_unpacklo_epi32(e0, e1));
+		STORE(out0 + 2 * x + 4, _mm_unpackhi_epi32(e0, e1));
+		STORE(out1 + 2 * x, _mm_unpacklo_epi32(e2, e3));
+		STORE(out1 + 2 * x + 4, _mm_unpackhi_epi32(e2, e3));
+	}
+}
+
+static void scale3x_sse2(const uint32_t* row, uint32_t* out0, uint32_t* out1, uint32_t* out2)
+{
+	for (int x = 0; x < FILTER_WIDTH; x += 4)
+	{
+		__m128i a = LOAD(row + x - STRIDE - 1), b = LOAD(row + x - STRIDE), c = LOAD(row + x - STRIDE + 1);
+		__m128i d = LOAD(row + x - 1), e = LOAD(row + x), f = LOAD(row + x + 1);
+		__m128i g = LOAD(row + x + STRIDE - 1), h = LOAD(row + x + STRIDE), i = LOAD(row + x + STRIDE + 1);
+
+		__m128i edge = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f)), _mm_set1_epi32(-1));
+
+		__m128i db = _mm_and_si128(_mm_cmpeq_epi32(d, b), edge), bf = _mm_and_si128(_mm_cmpeq_epi32(b, f), edge);
+		__m128i dh = _mm_and_si128(_mm_cmpeq_epi32(d, h), edge), hf = _mm_and_si128(_mm_cmpeq_epi32(h, f), edge);
+
+		// ANDNOT(E == X, m): m where E differs from X
+		__m128i ea = _mm_cmpeq_epi32(e, a), ec = _mm_cmpeq_epi32(e, c);
+		__m128i eg = _mm_cmpeq_epi32(e, g), ei = _mm_cmpeq_epi32(e, i);
+
+		store3(out0 + 3 * x, select128(db, d, e),
+		       select128(_mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf)), b, e),
+		       select128(bf, f, e));
+		store3(out1 + 3 * x, select128(_mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh)), d, e),
+		       e,
+		       select128(_mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf)), f, e));
+		store3(out2 + 3 * x, select128(dh, d, e),
+		       select128(_mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf)), h, e),
+		       select128(hf, f, e));
+	}
+}
+
+#define LOAD256(p) 	_mm256_loadu_si256((const __m256i*)(p))
+#define STORE256(p, v) 	_mm256_storeu_si256((__m256i*)(p), v)
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline AVX2 __m256i select256(__m256i mask, __m256i a, __m256i b)
+{
+	return _mm256_blendv_epi8(b, a, mask);
+}
+
+// Stores p and q interleaved; unpacking works within 128 bit lanes, so the
+// lane halves have to be put back in order
+static inline AVX2 void store2(uint32_t* out, __m256i p, __m256i q)
+{
+	__m256i lo = _mm256_unpacklo_epi32(p, q), hi = _mm256_unpackhi_epi32(p, q);
+
+	STORE256(out, _mm256_permute2x128_si256(lo, hi, 0x20));
+	STORE256(out + 8, _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+static inline AVX2 void store3_256(uint32_t* out, __m256i p, __m256i q, __m256i r)
+{
+	store3(out, _mm256_castsi256_si128(p), _mm256_castsi256_si128(q), _mm256_castsi256_si128(r));
+	store3(out + 12, _mm256_extracti128_si256(p, 1), _mm256_extracti128_si256(q, 1), _mm256_extracti128_si256(r, 1));
+}
+
+static AVX2 void widen_avx2(const uint32_t* row, uint32_t* out, int scale)
+{
+	if (scale == 2)
+	{
+		for (int x = 0; x < FILTER_WIDTH; x += 8)
+		{
+			__m256i v = LOAD256(row + x);
+			store2(out + 2 * x, v, v);
+		}
+	}
+	else
+	{
+		const __m256i first = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+		const __m256i second = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+
+		for (int x = 0; x < FILTER_WIDTH; x += 4)
+		{
+			__m256i v = _mm256_castsi128_si256(LOAD(row + x));
+
+			STORE256(out + 4 * x, _mm256_permutevar8x32_epi32(v, first));
+			STORE256(out + 4 * x + 8, _mm256_permutevar8x32_epi32(v, second));
+		}
+	}
+}
+
+static AVX2 void bleed_avx2(const uint32_t* row, uint32_t* out)
+{
+	for (int x = 0; x < FILTER_WIDTH; x += 8)
+		STORE256(out + x, _mm256_avg_epu8(LOAD256(row + x), _mm256_avg_epu8(LOAD256(row + x - 1), LOAD256(row + x + 1))));
+}
+
+static AVX2 void darken_avx2(const uint32_t* row, uint32_t* out, size_t count)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7F7F7F7F);
+
+	for (size_t x = 0; x < count; x += 8)
+		STORE256(out + x, _mm256_and_si256(_mm256_srli_epi32(LOAD256(row + x), 1), mask));
+}
+
+static AVX2 void scale2x_avx2(const uint32_t* row, uint32_t* out0, uint32_t* out1)
+{
+	for (int x = 0; x < FILTER_WIDTH; x += 8)
+	{
+		__m256i b = LOAD256(row + x - STRIDE), d = LOAD256(row + x - 1), e = LOAD256(row + x);
+		__m256i f = LOAD256(row + x + 1), h = LOAD256(row + x + STRIDE);
+
+		__m256i edge = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi32(b, h), _mm256_cmpeq_epi32(d, f)),
+						   _mm256_set1_epi32(-1));
+
+		store2(out0 + 2 * x, select256(_mm256_and_si256(_mm256_cmpeq_epi32(d, b), edge), d, e),
+		       select256(_mm256_and_si256(_mm256_cmpeq_epi32(b, f), edge), f, e));
+		store2(out1 + 2 * x, select256(_mm256_and_si256(_mm256_cmpeq_epi32(d, h), edge), d, e),
+		       select256(_mm256_and_si256(_mm256_cmpeq_epi32(h, f), edge), f, e));
+	}
+}
+
+static AVX2 void scale3x_avx2(const uint32_t* row, uint32_t* out0, uint32_t* out1, uint32_t* out2)
+{
+	for (int x = 0; x < FILTER_WIDTH; x += 8)
+	{
+		__m256i a = LOAD256(row + x - STRIDE - 1), b = LOAD256(row + x - STRIDE), c = LOAD256(row + x - STRIDE + 1);
+		__m256i d = LOAD256(row + x - 1), e = LOAD256(row + x), f = LOAD256(row + x + 1);
+		__m256i g = LOAD256(row + x + STRIDE - 1), h = LOAD256(row + x + STRIDE), i = LOAD256(row + x + STRIDE + 1);
+
+		__m256i edge = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi32(b, h), _mm256_cmpeq_epi32(d, f)),
+						   _mm256_set1_epi32(-1));
+
+		__m256i db = _mm256_and_si256(_mm256_cmpeq_epi32(d, b), edge), bf = _mm256_and_si256(_mm256_cmpeq_epi32(b, f), edge);
+		__m256i dh = _mm256_and_si256(_mm256_cmpeq_epi32(d, h), edge), hf = _mm256_and_si256(_mm256_cmpeq_epi32(h, f), edge);
+
+		__m256i ea = _mm256_cmpeq_epi32(e, a), ec = _mm256_cmpeq_epi32(e, c);
+		__m256i eg = _mm256_cmpeq_epi32(e, g), ei = _mm256_cmpeq_epi32(e, i);
+
+		store3_256(out0 + 3 * x, select256(db, d, e),
+			   select256(_mm256_or_si256(_mm256_andnot_si256(ec, db), _mm256_andnot_si256(ea, bf)), b, e),
+			   select256(bf, f, e));
+		store3_256(out1 + 3 * x, select256(_mm256_or_si256(_mm256_andnot_si256(eg, db), _mm256_andnot_si256(ea, dh)), d, e),
+			   e,
+			   select256(_mm256_or_si256(_mm256_andnot_si256(ei, bf), _mm256_andnot_si256(ec, hf)), f, e));
+		store3_256(out2 + 3 * x, select256(dh, d, e),
+			   select256(_mm256_or_si256(_mm256_andnot_si256(ei, dh), _mm256_andnot_si256(eg, hf)), h, e),
+			   select256(hf, f, e));
+	}
+}
+
+static const struct Kernels 	kernels[ISAS] = {
+	{ widen_scalar, bleed_scalar, darken_scalar, scale2x_scalar, scale3x_scalar },
+	{ widen_sse2, bleed_sse2, darken_sse2, scale2x_sse2, scale3x_sse2 },
+	{ widen_avx2, bleed_avx2, darken_avx2, scale2x_avx2, scale3x_avx2 },
+};
+
+#else
+
+static const struct Kernels 	kernels[ISAS] = {
+	{ widen_scalar, bleed_scalar, darken_scalar, scale2x_scalar, scale3x_scalar },
+};
+
+#endif
+
+static enum filter_isa 	isa = ISAS;	// the best there is, once filter_apply() runs
+
+int filter_find(const char* name)
+{
+	for (int i = 0; i < FILTERS; i++)
+		if (strcmp(filters[i].name, name) == 0)
+			return i;
+
+	return -1;
+}
+
+int filter_isa_supported(enum filter_isa which)
+{
+	switch (which)
+	{
+		case ISA_Scalar:
+			return 1;
+#if defined(__x86_64__)
+		case ISA_SSE2:
+			return 1;
+		case ISA_AVX2:
+			return __builtin_cpu_supports("avx2");
+#endif
+		default:
+			return 0;
+	}
+}
+
+// Returns nonzero if this host can't run the kernels for which
+int filter_set_isa(enum filter_isa which)
+{
+	if (!filter_isa_supported(which))
+		return 1;
+
+	isa = which;
+
+	return 0;
+}
+
+static void convert(const uint8_t* screen)
+{
+	for (int y = 0; y < FILTER_HEIGHT; y++)
+	{
+		uint32_t* row = PIXEL(0, y);
+		const uint8_t* rgb = screen + y * FILTER_WIDTH * 3;
+
+		for (int x = 0; x < FILTER_WIDTH; x++, rgb += 3)
+			row[x] = (uint32_t)rgb[0] << 16 | (uint32_t)rgb[1] << 8 | rgb[2];
+
+		row[-1] = row[0];
+		row[FILTER_WIDTH] = row[FILTER_WIDTH - 1];
+	}
+
+	memcpy(PIXEL(-1, -1), PIXEL(-1, 0), STRIDE * sizeof(uint32_t));
+	memcpy(PIXEL(-1, FILTER_HEIGHT), PIXEL(-1, FILTER_HEIGHT - 1), STRIDE * sizeof(uint32_t));
+}
+
+void filter_apply(enum filter filter, const uint8_t* screen, uint32_t* output)
+{
+	if (isa == ISAS)
+		isa = filter_isa_supported(ISA_AVX2) ? ISA_AVX2 : filter_isa_supported(ISA_SSE2) ? ISA_SSE2 : ISA_Scalar;
+
+	const struct Kernels* k = &kernels[isa];
+	const size_t width = FILTER_WIDTH * filters[filter].scale;
+	const size_t row_size = width * sizeof(uint32_t);
+
+	uint32_t bled[FILTER_WIDTH];
+
+	convert(screen);
+
+	for (int y = 0; y < FILTER_HEIGHT; y++)
+	{
+		const uint32_t* row = PIXEL(0, y);
+		uint32_t* out = output + y * filters[filter].scale * width;
+
+		switch (filter)
+		{
+			case Filter_Nearest:
+				k->widen(row, out, 4);
+				memcpy(out + width, out, row_size);
+				memcpy(out + 2 * width, out, 2 * row_size);
+				break;
+			case Filter_Scale2x:
+				k->scale2x(row, out, out + width);
+				break;
+			case Filter_Scale3x:
+				k->scale3x(row, out, out + width, out + 2 * width);
+				break;
+			case Filter_NTSC:
+				k->bleed(row, bled);
+				k->widen(bled, out, 2);
+				memcpy(out + width, out, row_size);
+				break;
+			case Filter_CRT:
+				k->widen(row, out, 4);
+				memcpy(out + width, out, row_size);
+				memcpy(out + 2 * width, out, row_size);
+				k->darken(out, out + 3 * width, width);
+				break;
+			default:
+				memcpy(out, row, row_size);
+				break;
+		}
+	}
+}
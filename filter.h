@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <stddef.h>
+
+// Host-side scalers from the PPU's RGB24 framebuffer to an XRGB8888 picture
+// an integer number of times larger, for the frontend to present. They only
+// ever see frames that are shown, so emulation speed is unaffected.
+
+#define FILTER_WIDTH 	256
+#define FILTER_HEIGHT 	240
+
+enum filter
+{
+	Filter_None, 		// conversion only; the renderer stretches it
+	Filter_Nearest, 	// integer nearest neighbour
+	Filter_Scale2x,
+	Filter_Scale3x,
+	Filter_NTSC, 		// colour bleeding along the line, as composite video blurs it
+	Filter_CRT, 		// nearest, with dark gaps between scanlines
+	FILTERS
+};
+
+enum filter_isa { ISA_Scalar, ISA_SSE2, ISA_AVX2, ISAS };
+
+struct Filter_Info
+{
+	const char* 	name;
+	uint8_t 	scale;
+};
+
+extern const struct Filter_Info 	filters[FILTERS];
+extern const char* const 		filter_isa_names[ISAS];
+
+int 	filter_find(const char* name);
+int 	filter_isa_supported(enum filter_isa isa);
+int 	filter_set_isa(enum filter_isa isa);
+
+// output is FILTER_WIDTH * scale by FILTER_HEIGHT * scale, rows contiguous
+void 	filter_apply(enum filter filter, const uint8_t* screen, uint32_t* output);
@@ -0,0 +1,226 @@
+#include <string.h>
+
+#include "idle.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "memory.h"
+#include "system.h"
+#include "disasm.h"
+
+// Games spend much of a frame spinning on `LDA $2002 / BPL` or `JMP *` until
+// VBlank or the NMI handler changes something. Such a loop reads nothing but
+// RAM, PRG and PPUSTATUS and writes nothing, so once a pass comes back to
+// the head with the registers unchanged and nothing could have changed what
+// it read, every further pass is the same until the next event. The CPU
+// then stalls at the head for whole passes instead of running them, and the
+// PPU and APU are clocked exactly as they would have been.
+
+CONSOLE_LOCAL struct Idle* 	idle;
+
+#define RENDERED_DOTS 	(240 * 341)
+
+// Instructions that only read memory and registers
+static const char* pure[] = {
+	"LDA", "LDX", "LDY", "BIT", "CMP", "CPX", "CPY", "AND", "ORA", "EOR", "ADC", "SBC",
+	"NOP", "TAX", "TAY", "TXA", "TYA", "CLC", "SEC", "CLV",
+	"BPL", "BMI", "BVC", "BVS", "BCC", "BCS", "BNE", "BEQ", "JMP"
+};
+
+void idle_reset()
+{
+	idle->head = 0;
+	idle->armed = false;
+}
+
+// For when PRG changes under the verdicts.
+void idle_flush()
+{
+	memset(idle->verdicts, Idle_Unknown, sizeof(idle->verdicts));
+	idle_reset();
+}
+
+static bool is_pure(const char* name)
+{
+	for (size_t i = 0; i < sizeof(pure) / sizeof(pure[0]); i++)
+		if (strcmp(name, pure[i]) == 0)
+			return true;
+
+	return false;
+}
+
+// Follows the code from head until something jumps back to it.
+static uint8_t analyse(uint16_t head)
+{
+	uint32_t address = head;
+	uint8_t verdict = Idle_Loop;
+
+	for (int i = 0; i < IDLE_MAX_INSTRUCTIONS; i++)
+	{
+		uint8_t opcode = prg_memory[address & 0x7FFF];
+		const struct Opcode_Info* info = &opcode_info[opcode];
+		uint8_t length = disasm_length(opcode);
+
+		if (address + length > 0x10000 || !is_pure(info->name))
+			return Idle_None;
+
+		uint16_t operand = 0;
+		if (length > 1)
+			operand = prg_memory[(address + 1) & 0x7FFF];
+		if (length > 2)
+			operand |= prg_memory[(address + 2) & 0x7FFF] << 8;
+
+		uint8_t size = address + length - head;
+
+		switch (info->mode)
+		{
+			case Mode_IMP:
+			case Mode_ACC:
+			case Mode_IMM:
+				break;
+
+			case Mode_ZP:
+			case Mode_ABS:
+				if (strcmp(info->name, "JMP") == 0)
+					return operand == head ? verdict | size << 2 : Idle_None;
+
+				if (operand >= 0x2000 && operand < 0x4000 && (operand & 0x0007) == 0x0002)
+					verdict = Idle_Poll_PPU;
+				else if (operand >= 0x2000 && operand < 0x8000)
+					return Idle_None;
+
+				break;
+
+			case Mode_REL:
+			{
+				uint16_t target = address + 2 + (int8_t)operand;
+
+				if (target == head)
+					return verdict | size << 2;
+
+				// the only way back allowed is to the head
+				if (target < head)
+					return Idle_None;
+
+				break;
+			}
+
+			default:
+				return Idle_None;
+		}
+
+		address += length;
+	}
+
+	return Idle_None;
+}
+
+// Cycles from now in which nothing the loop reads can change.
+static uint32_t horizon()
+{
+	uint32_t cycles = system_event_horizon();
+
+	if (idle->kind == Idle_Poll_PPU)
+	{
+		const struct TV_Timing* timing = &tv_timings[tv_system];
+
+		// sprite 0, overflow and VBlank are cleared then
+		uint32_t prerender = timing->prerender_line * 341 + 1;
+		uint32_t dot = ppu.scanline * 341 + ppu.cycle;
+
+		// sprite 0 hit and overflow can turn up anywhere on a rendered line
+		if (dot < RENDERED_DOTS && ppu.render_mode != Render_Off)
+			return 0;
+
+		if (dot <= prerender && (prerender - dot) / timing->dots_per_cycle < cycles)
+			cycles = (prerender - dot) / timing->dots_per_cycle;
+	}
+
+	return cycles;
+}
+
+static void arm()
+{
+	idle->armed = true;
+	idle->a = cpu.a;
+	idle->x = cpu.x;
+	idle->y = cpu.y;
+	idle->p = cpu.p;
+	idle->sp = cpu.sp;
+	idle->cycle = cpu_cycle_count;
+	idle->horizon = horizon();
+}
+
+// The CPU is back at the head of the loop it is in.
+static uint8_t pass()
+{
+	uint64_t length = cpu_cycle_count - idle->cycle;
+
+	// the last pass went round unchanged, and nothing happened during it
+	bool repeated = idle->armed && length <= IDLE_MAX_ITERATION && length <= idle->horizon &&
+		idle->a == cpu.a && idle->x == cpu.x && idle->y == cpu.y &&
+		idle->p == cpu.p && idle->sp == cpu.sp;
+
+	if (!repeated)
+	{
+		arm();
+		return 0;
+	}
+
+	uint32_t quiet = horizon();
+	uint32_t passes = quiet / length;
+
+	// cycles only holds so much; the next pass through here picks up
+	if (passes > UINT8_MAX / length)
+		passes = UINT8_MAX / length;
+
+	if (passes == 0)
+	{
+		arm();
+		return 0;
+	}
+
+	uint8_t stall = passes * length;
+
+	// as if the last skipped pass had just started
+	idle->cycle = cpu_cycle_count + stall - length;
+	idle->horizon = quiet - (stall - length);
+
+	idle->skipped_cycles += stall;
+	idle->skips++;
+
+	return stall;
+}
+
+// Called at every instruction boundary. Returns cycles for the CPU to stall
+// at pc in place of passes of a polling loop, or 0 to run normally.
+uint8_t idle_check()
+{
+	uint16_t from = idle->last_pc;
+	idle->last_pc = cpu.pc;
+
+	if (cpu.pc == idle->head && cpu.pc != 0)
+		return pass();
+
+	// anywhere outside the body, even briefly, may have written something
+	if ((uint16_t)(cpu.pc - idle->head) >= idle->size)
+		idle->armed = false;
+
+	// only a jump backwards can close a loop
+	if (cpu.pc < 0x8000 || cpu.pc > from || from - cpu.pc > IDLE_MAX_DISTANCE)
+		return 0;
+
+	uint8_t* verdict = &idle->verdicts[cpu.pc & 0x7FFF];
+
+	if (*verdict == Idle_Unknown)
+		*verdict = analyse(cpu.pc);
+
+	if (IDLE_VERDICT(*verdict) == Idle_None)
+		return 0;
+
+	idle->head = cpu.pc;
+	idle->size = IDLE_SIZE(*verdict);
+	idle->kind = IDLE_VERDICT(*verdict);
+	arm();
+
+	return 0;
+}
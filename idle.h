@@ -0,0 +1,47 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "console.h"
+
+#define IDLE_MAX_INSTRUCTIONS 	8	// in a loop body
+#define IDLE_MAX_DISTANCE 	32	// bytes back to the loop head
+#define IDLE_MAX_ITERATION 	64	// cycles per pass
+
+enum idle_verdict
+{
+	Idle_Unknown, 	// not analysed yet
+	Idle_None, 	// not a loop, or one with side effects
+	Idle_Loop, 	// reads only RAM and PRG, so waits on an interrupt
+	Idle_Poll_PPU 	// also reads $2002
+};
+
+#define IDLE_VERDICT(v) 	((v) & 0x03)
+#define IDLE_SIZE(v) 		((v) >> 2)
+
+// Polling loops found in PRG-ROM, and the one the CPU is in right now
+struct Idle
+{
+	bool 		enabled;
+	uint8_t 	verdicts[0x8000];	// by loop head & 0x7FFF; IDLE_VERDICT() | body size << 2
+
+	uint16_t 	last_pc;		// of the previous instruction boundary
+	uint16_t 	head;			// loop being watched, 0 for none
+	uint8_t 	size;			// of its body in bytes
+	uint8_t 	kind;
+
+	// CPU state the last time it passed the head
+	bool 		armed;
+	uint8_t 	a, x, y, p, sp;
+	uint64_t 	cycle;
+	uint32_t 	horizon;		// quiet cycles it had ahead of it then
+
+	uint64_t 	skipped_cycles;
+	uint64_t 	skips;
+};
+
+extern CONSOLE_LOCAL struct Idle* 	idle;
+
+void 		idle_reset();
+void 		idle_flush();
+uint8_t 	idle_check();
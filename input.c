@@ -0,0 +1,98 @@
+#include <SDL2/SDL.h>
+
+#include "input.h"
+#include "controller.h"
+
+struct Key_Binding
+{
+	int 		code;
+	uint8_t 	button;
+};
+
+static const struct Key_Binding keyboard_bindings[CONTROLLER_PORTS][8] = {
+	{
+		{ SDL_SCANCODE_SLASH,	BUTTON_A },
+		{ SDL_SCANCODE_PERIOD,	BUTTON_B },
+		{ SDL_SCANCODE_RSHIFT,	BUTTON_SELECT },
+		{ SDL_SCANCODE_RETURN,	BUTTON_START },
+		{ SDL_SCANCODE_UP,	BUTTON_UP },
+		{ SDL_SCANCODE_DOWN,	BUTTON_DOWN },
+		{ SDL_SCANCODE_LEFT,	BUTTON_LEFT },
+		{ SDL_SCANCODE_RIGHT,	BUTTON_RIGHT }
+	},
+	{
+		{ SDL_SCANCODE_G,	BUTTON_A },
+		{ SDL_SCANCODE_F,	BUTTON_B },
+		{ SDL_SCANCODE_Q,	BUTTON_SELECT },
+		{ SDL_SCANCODE_E,	BUTTON_START },
+		{ SDL_SCANCODE_W,	BUTTON_UP },
+		{ SDL_SCANCODE_S,	BUTTON_DOWN },
+		{ SDL_SCANCODE_A,	BUTTON_LEFT },
+		{ SDL_SCANCODE_D,	BUTTON_RIGHT }
+	}
+};
+
+static const struct Key_Binding gamepad_bindings[8] = {
+	{ SDL_CONTROLLER_BUTTON_A,		BUTTON_A },
+	{ SDL_CONTROLLER_BUTTON_X,		BUTTON_B },
+	{ SDL_CONTROLLER_BUTTON_BACK,		BUTTON_SELECT },
+	{ SDL_CONTROLLER_BUTTON_START,		BUTTON_START },
+	{ SDL_CONTROLLER_BUTTON_DPAD_UP,	BUTTON_UP },
+	{ SDL_CONTROLLER_BUTTON_DPAD_DOWN,	BUTTON_DOWN },
+	{ SDL_CONTROLLER_BUTTON_DPAD_LEFT,	BUTTON_LEFT },
+	{ SDL_CONTROLLER_BUTTON_DPAD_RIGHT,	BUTTON_RIGHT }
+};
+
+SDL_GameController* gamepads[CONTROLLER_PORTS];
+
+void input_init()
+{
+	SDL_Init(SDL_INIT_GAMECONTROLLER);
+
+	uint8_t port = 0;
+	for (int i = 0; i < SDL_NumJoysticks() && port < CONTROLLER_PORTS; i++)
+	{
+		if (SDL_IsGameController(i))
+			gamepads[port++] = SDL_GameControllerOpen(i);
+	}
+}
+
+// Pumps SDL events and, for the SDL backend, latches keyboard and gamepad
+// state into the controller ports. Returns false once the user wants to quit.
+bool input_poll()
+{
+	SDL_Event event;
+	bool quit = false;
+
+	while ( SDL_PollEvent( &event ) )
+	{
+		if (event.type == SDL_QUIT)
+			quit = true;
+	}
+
+	const uint8_t* keys = SDL_GetKeyboardState(NULL);
+
+	if (keys[SDL_SCANCODE_ESCAPE])
+		quit = true;
+
+	if (input_backend != Input_SDL)
+		return !quit;
+
+	for (uint8_t port = 0; port < CONTROLLER_PORTS; port++)
+	{
+		uint8_t buttons = 0x00;
+
+		for (uint8_t i = 0; i < 8; i++)
+		{
+			if (keys[keyboard_bindings[port][i].code])
+				buttons |= keyboard_bindings[port][i].button;
+
+			if (gamepads[port] && SDL_GameControllerGetButton(gamepads[port], gamepad_bindings[i].code))
+				buttons |= gamepad_bindings[i].button;
+		}
+
+		set_controller_state(port, buttons);
+	}
+
+	return !quit;
+}
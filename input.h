@@ -0,0 +1,5 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+void 	input_init();
+bool 	input_poll();
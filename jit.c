@@ -0,0 +1,286 @@
+#define _GNU_SOURCE	// memfd_create()
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "memory.h"
+#include "system.h"
+#include "trace.h"
+#include "profile.h"
+
+// Blocks are straight runs of PRG-ROM instructions compiled to x86-64 that
+// calls each instruction's handler with its operand baked in, so decode and
+// dispatch disappear. A block runs all at once at its first cycle and the
+// PPU then catches up, which is only invisible if nothing in it can be
+// observed: handlers refuse I/O accesses and end the block there, RAM is
+// never compiled, and a block is only entered if its worst case fits before
+// the next NMI, frame end or APU IRQ.
+//
+// The code buffer is one memfd mapped twice, writable at code for compile()
+// and executable at exec for everything else, so no page is ever both. It
+// cannot be flipped with mprotect() instead: other consoles on the same
+// cartridge run blocks from it while one compiles.
+
+CONSOLE_LOCAL struct JIT* 	jit;
+
+#define UNCOMPILABLE 	((jit_block)1)
+
+#if defined(__x86_64__)
+
+struct JIT* jit_create()
+{
+	struct JIT* j = calloc(1, sizeof(struct JIT));
+
+	if (j == NULL)
+		return NULL;
+
+	int fd = memfd_create("nesemu-jit", MFD_CLOEXEC);
+
+	if (fd < 0)
+	{
+		free(j);
+		return NULL;
+	}
+
+	j->code = MAP_FAILED;
+	j->exec = MAP_FAILED;
+
+	if (ftruncate(fd, JIT_CODE_SIZE) == 0)
+	{
+		j->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		j->exec = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+	}
+
+	close(fd);
+
+	if (j->code == MAP_FAILED || j->exec == MAP_FAILED)
+	{
+		if (j->code != MAP_FAILED)
+			munmap(j->code, JIT_CODE_SIZE);
+		if (j->exec != MAP_FAILED)
+			munmap(j->exec, JIT_CODE_SIZE);
+
+		free(j);
+		return NULL;
+	}
+
+	pthread_mutex_init(&j->lock, NULL);
+
+	return j;
+}
+
+void jit_destroy(struct JIT* j)
+{
+	if (j == NULL)
+		return;
+
+	munmap(j->code, JIT_CODE_SIZE);
+	munmap(j->exec, JIT_CODE_SIZE);
+	pthread_mutex_destroy(&j->lock);
+	free(j);
+}
+
+// For when PRG changes under the blocks (a new ROM, a bank switch). Nothing
+// may be running them.
+void jit_flush(struct JIT* j)
+{
+	if (j == NULL)
+		return;
+
+	pthread_mutex_lock(&j->lock);
+
+	memset(j->blocks, 0, sizeof(j->blocks));
+	memset(j->heat, 0, sizeof(j->heat));
+	j->code_used = 0;
+	j->compiled_blocks = 0;
+	j->compiled_instructions = 0;
+
+	pthread_mutex_unlock(&j->lock);
+}
+
+// The code is stamped out from these, so the space a block can take is
+// their sizes and cannot disagree with what is emitted
+static const uint8_t prologue[] = {
+	0x53,						// push rbx
+	0x31, 0xDB,					// xor ebx, ebx
+};
+
+static const uint8_t epilogue[] = {
+	0x89, 0xD8,					// mov eax, ebx
+	0x5B,						// pop rbx
+	0xC3,						// ret
+};
+
+static const uint8_t call[] = {
+	0xBF, 0x00, 0x00, 0x00, 0x00,			// mov edi, operand
+	0xBE, 0x00, 0x00, 0x00, 0x00,			// mov esi, next
+	0x48, 0xB8, 0x00, 0x00, 0x00, 0x00,		// mov rax, handler
+	0x00, 0x00, 0x00, 0x00,
+	0xFF, 0xD0,					// call rax
+	0x0F, 0xB6, 0xC0,				// movzx eax, al
+	0x85, 0xC0,					// test eax, eax
+	0x0F, 0x84, 0x00, 0x00, 0x00, 0x00,		// jz exit
+	0x01, 0xC3,					// add ebx, eax
+};
+
+// where call[] takes its operands
+#define CALL_OPERAND 	1
+#define CALL_NEXT 	6
+#define CALL_HANDLER 	12
+#define CALL_EXIT 	29
+
+_Static_assert(sizeof(call) == CALL_EXIT + 4 + 2, "call[] ends with jz's rel32 and add ebx, eax");
+
+static inline uint8_t* emit(uint8_t* p, const uint8_t* code, size_t size)
+{
+	memcpy(p, code, size);
+	return p + size;
+}
+
+static inline bool ends_block(uint8_t opcode)
+{
+	// branches, BRK, JSR, RTI, RTS and both JMPs, plus CLI and PLP so a
+	// pending IRQ they unmask is taken at the next boundary
+	return (opcode & 0x1F) == 0x10 || opcode == 0x00 || opcode == 0x20 || opcode == 0x40 ||
+		opcode == 0x60 || opcode == 0x4C || opcode == 0x6C || opcode == 0x58 || opcode == 0x28;
+}
+
+static jit_block compile(struct JIT* j, uint16_t start, uint8_t* worst)
+{
+	if (j->code_used + sizeof(prologue) + JIT_MAX_INSTRUCTIONS * sizeof(call) + sizeof(epilogue) > JIT_CODE_SIZE)
+		return UNCOMPILABLE;
+
+	uint8_t* code = j->code + j->code_used;
+	uint8_t* p = code;
+	uint8_t* exits[JIT_MAX_INSTRUCTIONS];
+	uint32_t address = start;
+	uint32_t cycles = 0;
+	int count = 0;
+
+	p = emit(p, prologue, sizeof(prologue));
+
+	while (count < JIT_MAX_INSTRUCTIONS)
+	{
+		uint8_t opcode = prg_memory[address & 0x7FFF];
+		uint8_t length = cpu_lengths[opcode];
+		uint8_t most = lut_cycles[opcode] + lut_pagecrosses[opcode];
+
+		// unknown opcodes are the interpreter's to report
+		if (length == 0 || address + length > 0x10000 || cycles + most > JIT_MAX_CYCLES)
+			break;
+
+		uint16_t operand = 0;
+		if (length > 1)
+			operand = prg_memory[(address + 1) & 0x7FFF];
+		if (length > 2)
+			operand |= prg_memory[(address + 2) & 0x7FFF] << 8;
+
+		uint32_t operand_value = operand;
+		uint32_t next = (uint16_t)(address + length);
+		uint64_t handler = (uint64_t)(uintptr_t)cpu_handlers[opcode];
+
+		memcpy(p, call, sizeof(call));
+		memcpy(p + CALL_OPERAND, &operand_value, 4);
+		memcpy(p + CALL_NEXT, &next, 4);
+		memcpy(p + CALL_HANDLER, &handler, 8);
+		exits[count] = p + CALL_EXIT;
+		p += sizeof(call);
+
+		cycles += most;
+		address += length;
+		count++;
+
+		if (ends_block(opcode))
+			break;
+	}
+
+	if (count == 0)
+		return UNCOMPILABLE;
+
+	uint8_t* exit = p;
+	p = emit(p, epilogue, sizeof(epilogue));
+
+	for (int i = 0; i < count; i++)
+	{
+		int32_t offset = exit - (exits[i] + 4);
+		memcpy(exits[i], &offset, 4);
+	}
+
+	j->code_used += p - code;
+	j->compiled_blocks++;
+	j->compiled_instructions += count;
+
+	*worst = cycles;
+	return (jit_block)(j->exec + (code - j->code));
+}
+
+// Called at an instruction boundary. Runs a block from pc and returns the
+// cycles it took, or 0 for the interpreter to take this instruction.
+uint8_t jit_execute()
+{
+	// a frame that ended this cycle must not see the block's instructions
+	if (cpu.pc < 0x8000 || trace != NULL || profile != NULL || frame_complete)
+		return 0;
+
+	if ((apu.frame_irq || apu.dmc_irq) && !is_cpu_flag_set(FLAG_I))
+		return 0;
+
+	uint16_t offset = cpu.pc & 0x7FFF;
+	jit_block block = __atomic_load_n(&jit->blocks[offset], __ATOMIC_ACQUIRE);
+
+	if (block == NULL)
+	{
+		uint8_t heat = __atomic_load_n(&jit->heat[offset], __ATOMIC_RELAXED);
+
+		if (heat < JIT_THRESHOLD)
+		{
+			__atomic_store_n(&jit->heat[offset], heat + 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+
+		pthread_mutex_lock(&jit->lock);
+
+		block = jit->blocks[offset];
+
+		if (block == NULL)
+		{
+			block = compile(jit, cpu.pc, &jit->worst_cycles[offset]);
+			__atomic_store_n(&jit->blocks[offset], block, __ATOMIC_RELEASE);
+		}
+
+		pthread_mutex_unlock(&jit->lock);
+	}
+
+	if (block == UNCOMPILABLE || jit->worst_cycles[offset] > system_event_horizon())
+		return 0;
+
+	return block();
+}
+
+#else
+
+struct JIT* jit_create()
+{
+	return NULL;
+}
+
+void jit_destroy(struct JIT* j)
+{
+}
+
+void jit_flush(struct JIT* j)
+{
+}
+
+uint8_t jit_execute()
+{
+	return 0;
+}
+
+#endif
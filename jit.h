@@ -0,0 +1,38 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "console.h"
+
+#define JIT_CODE_SIZE 		(8 << 20)
+#define JIT_THRESHOLD 		8	// visits before a PC gets a block
+#define JIT_MAX_INSTRUCTIONS 	32
+#define JIT_MAX_CYCLES 		128
+
+typedef uint8_t (*jit_block)();
+
+// Translated PRG-ROM code, indexed by ROM offset. Derived only from PRG, so
+// consoles sharing a cartridge share one; blocks are published atomically
+// and compiled under the lock.
+struct JIT
+{
+	uint8_t*		code;		// written through
+	uint8_t*		exec;		// run from, the same pages
+	size_t 			code_used;
+	pthread_mutex_t 	lock;
+
+	jit_block 		blocks[0x8000];
+	uint8_t 		worst_cycles[0x8000];
+	uint8_t 		heat[0x8000];
+
+	uint64_t 		compiled_blocks;
+	uint64_t 		compiled_instructions;
+};
+
+extern CONSOLE_LOCAL struct JIT* 	jit;
+
+struct JIT* 	jit_create();
+void 		jit_destroy(struct JIT* j);
+void 		jit_flush(struct JIT* j);
+uint8_t 	jit_execute();
@@ -4,57 +4,363 @@
 #include "controller.h"
 #include "cpu.h"
 #include "memory.h"
+#include "movie.h"
+#include "input.h"
+#include "audio.h"
+#include "apu.h"
+#include "wav.h"
+#include "trace.h"
+#include "jit.h"
+#include "ppu.h"
+#include "state.h"
+#include "stats.h"
+#include "profile.h"
+#include "export.h"
+#include "snapcache.h"
+#include "bench.h"
+
+static char* trace_filename = NULL;
+static FILE* stats_file = NULL;
+static char* profile_filename = NULL;
+static char* export_name = NULL;
+
+static uint8_t* ahead_state;
+static struct APU_Buffer* ahead_audio;
+static double ahead_seconds;
+static double frame_seconds;
+
+// also runs on the exit() taken for an illegal opcode, which is when the
+// trace is wanted most
+static void dump_trace()
+{
+	if (trace_dump(trace_filename) != 0)
+		printf("Cannot write trace %s\n", trace_filename);
+}
+
+static void write_profile()
+{
+	if (profile_report(profile_filename) != 0)
+		printf("Cannot write profile %s\n", profile_filename);
+}
+
+// Runs `frames` frames on with the input just latched, keeping only the last
+// one's picture, then puts the console back. Games react to a button a frame
+// or more after reading it, so showing that picture hides their lag.
+static void run_ahead(int frames)
+{
+	double start = seconds();
+	struct Trace* traced = trace;
+	struct Profile* profiled = profile;
+
+	state_save(ahead_state);
+	memcpy(ahead_audio, apu_buffer, sizeof(struct APU_Buffer));
+
+	// the trace and profile show only what really ran
+	trace = NULL;
+	profile = NULL;
+
+	for (int i = 1; i <= frames; i++)
+	{
+		skip_pixels = i < frames;
+		system_step_frame();
+	}
+
+	trace = traced;
+	profile = profiled;
+
+	memcpy(apu_buffer, ahead_audio, sizeof(struct APU_Buffer));
+	state_load(ahead_state);
+
+	ahead_seconds += seconds() - start;
+}
+
+static void usage()
+{
+	printf("usage: nesemu <rom> [--record <movie> | --play <movie>] [--headless] [--wav <file>] [--mute] [--jit]\n"
+	       "              [--trace <file> [--trace-length <instructions>]] [--run-ahead <frames>]\n"
+	       "              [--stats <file>] [--profile <file>] [--region ntsc|pal|dendy]\n"
+	       "              [--filter none|nearest|scale2x|scale3x|ntsc|crt] [--export <shm name>]\n"
+	       "              [--cache <directory> [--cache-size <MB>]]\n");
+}
 
 int main(int argc, char *argv[])
 {
-	memory_init();
+	char* filename = NULL;
+	char* record_filename = NULL;
+	char* play_filename = NULL;
+	char* wav_filename = NULL;
+	bool headless = false;
+	bool use_jit = false;
+	bool mute = false;
+	size_t trace_length = 1 << 20;
+	int ahead = 0;
+	int region = -1;	// as the ROM header says
+	int filter = Filter_None;
+	char* cache_directory = NULL;
+	uint64_t cache_megabytes = 256;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+			record_filename = argv[++i];
+		else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc)
+			play_filename = argv[++i];
+		else if (strcmp(argv[i], "--wav") == 0 && i + 1 < argc)
+			wav_filename = argv[++i];
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			trace_filename = argv[++i];
+		else if (strcmp(argv[i], "--trace-length") == 0 && i + 1 < argc)
+			trace_length = strtoul(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+		{
+			char* stats_filename = argv[++i];
+
+			stats_file = strcmp(stats_filename, "-") == 0 ? stderr : fopen(stats_filename, "w");
+
+			if (stats_file == NULL)
+			{
+				printf("Cannot create %s\n", stats_filename);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+			profile_filename = argv[++i];
+		else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc)
+			export_name = argv[++i];
+		else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+			cache_directory = argv[++i];
+		else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc)
+			cache_megabytes = strtoull(argv[++i], NULL, 0);
+		else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc)
+			ahead = atoi(argv[++i]);
+		else if (strcmp(argv[i], "--region") == 0 && i + 1 < argc)
+		{
+			const char* name = argv[++i];
+
+			region = strcmp(name, "ntsc") == 0 ? NTSC : strcmp(name, "pal") == 0 ? PAL :
+				 strcmp(name, "dendy") == 0 ? Dendy : -1;
+
+			if (region < 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+		{
+			if ((filter = filter_find(argv[++i])) < 0)
+			{
+				usage();
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--headless") == 0)
+			headless = true;
+		else if (strcmp(argv[i], "--jit") == 0)
+			use_jit = true;
+		else if (strcmp(argv[i], "--mute") == 0)
+			mute = true;
+		else if (filename == NULL)
+			filename = argv[i];
+		else
+		{
+			usage();
+			return 1;
+		}
+	}
+
+	// without a movie to drive input there is nothing to read the keyboard from
+	if (filename == NULL || (headless && play_filename == NULL) || (record_filename && play_filename))
+	{
+		usage();
+		return 1;
+	}
+
+#ifndef NESEMU_STATS
+	if (stats_file)
+		printf("Built without NESEMU_STATS, so --stats shows only zeros\n");
+#endif
+
+	uint8_t* arena = aligned_alloc(MEMORY_ALIGN, memory_init(NULL, true));
+
+	if (arena == NULL)
+	{
+		printf("Out of memory\n");
+		return 1;
+	}
+
+	memory_init(arena, true);
 
-	char* filename = argv[1];
 	if (load_cartridge(filename) != 0)
 	{
 		printf("File I/O Error\n");
 		return 1;
 	}
 
-	video_init();
+	if (region >= 0)
+		tv_system = region;
+
+	if (use_jit && (jit = jit_create()) == NULL)
+		printf("No JIT on this platform, interpreting\n");
+
+	if (record_filename && movie_record(record_filename) != 0)
+	{
+		printf("Cannot create movie %s\n", record_filename);
+		return 1;
+	}
+
+	if (play_filename && movie_play(play_filename) != 0)
+		return 1;
+
+	if (wav_filename && wav_open(wav_filename, APU_SAMPLE_RATE) != 0)
+	{
+		printf("Cannot create %s\n", wav_filename);
+		return 1;
+	}
+
+	if (trace_filename)
+	{
+		if (trace_start(trace_length) != 0)
+		{
+			printf("Cannot allocate trace buffer\n");
+			return 1;
+		}
+
+		atexit(dump_trace);
+	}
+
+	if (profile_filename)
+	{
+		if (profile_start() != 0)
+		{
+			printf("Cannot allocate profile\n");
+			return 1;
+		}
+
+		atexit(write_profile);
+	}
+
+	if (export_name)
+	{
+		if (export_start(export_name) != 0)
+		{
+			printf("Cannot create shared memory %s\n", export_name);
+			return 1;
+		}
+
+		// removes the segment
+		atexit(export_stop);
+	}
+
+	if (ahead > 0)
+	{
+		ahead_state = malloc(state_save(NULL));
+		ahead_audio = malloc(sizeof(struct APU_Buffer));
 
-	reset();
+		if (ahead_state == NULL || ahead_audio == NULL)
+		{
+			printf("Cannot allocate run-ahead snapshot\n");
+			return 1;
+		}
+	}
+
+	if (!headless)
+	{
+		video_init(filter);
+		input_init();
+
+		if (!mute)
+			audio_init();
+	}
+
+	system_reset();
+
+	// snapshots are keyed by input, so only a movie can use them
+	bool caching = cache_directory && movie_mode != Movie_Off;
+
+	if (caching)
+	{
+		if (snapcache_open(cache_directory, cache_megabytes << 20) != 0)
+		{
+			printf("Cannot use %s as a snapshot cache\n", cache_directory);
+			return 1;
+		}
+
+		// the frames skipped would be missing from these
+		bool resumable = movie_mode == Movie_Play && !wav_filename && !trace_filename && !profile_filename;
+		uint32_t resumed = snapcache_resume(movie_data, resumable ? movie_header.frames : 0, movie_header.ports);
+
+		if (resumed > 0)
+		{
+			movie_seek(resumed);
+			printf("Resumed at frame %u from the snapshot cache\n", resumed);
+		}
+	}
 
-	SDL_Event event;
 	bool quit = false;
+	uint64_t frames = 0;
 
 	while (!quit) {
 
-		const uint8_t* keys = SDL_GetKeyboardState(NULL);
+		if (!headless)
+			quit = !input_poll();
 
-		while ( SDL_PollEvent( &event ) )
-		{
-			reset_controller();
+		// input is latched once per frame so a movie reproduces it exactly
+		if (!movie_frame())
+			break;
+
+		// with run-ahead this frame's picture is never shown
+		double start = seconds();
+		skip_pixels = ahead > 0;
+		system_step_frame();
+		frame_seconds += seconds() - start;
+		frames++;
+
+		if (caching)
+			snapcache_frame(movie_input, movie_header.ports);
+
+		wav_write(apu_buffer->samples, apu_buffer->sample_count);
 
-			if (keys[SDL_SCANCODE_ESCAPE])
-				quit = true;
+		if (!headless && !mute)
+			audio_queue(apu_buffer->samples, apu_buffer->sample_count);
 
-			if (keys[SDL_SCANCODE_SLASH])
-				controller_state |= BUTTON_A;
-			if (keys[SDL_SCANCODE_PERIOD])
-				controller_state |= BUTTON_B;
-			if (keys[SDL_SCANCODE_RSHIFT])
-				controller_state |= BUTTON_SELECT;
-			if (keys[SDL_SCANCODE_RETURN])
-				controller_state |= BUTTON_START;
-			if (keys[SDL_SCANCODE_UP])
-				controller_state |= BUTTON_UP;
-			if (keys[SDL_SCANCODE_DOWN])
-				controller_state |= BUTTON_DOWN;
-			if (keys[SDL_SCANCODE_LEFT])
-				controller_state |= BUTTON_LEFT;
-			if (keys[SDL_SCANCODE_RIGHT])
-				controller_state |= BUTTON_RIGHT;
+		if (ahead > 0)
+			run_ahead(ahead);
+
+		// the picture about to be shown, with the RAM of the frame really run
+		if (frame_export)
+			export_publish();
+
+		if (!headless)
+		{
+			STAT_TIMER_START(present);
+			video_display_frame();
+			STAT_TIMER_STOP(present, Timer_Present);
 		}
 
-		clock();
+		// a line a second
+		if (stats_file && frames % 60 == 0)
+			stats_dump(stats_file);
 	}
 
+	if (ahead > 0 && frames > 0)
+		printf("run-ahead %d: %.2f ms per frame on top of %.2f ms emulating it\n",
+		       ahead, ahead_seconds * 1000 / frames, frame_seconds * 1000 / frames);
+
+	if (stats_file)
+	{
+		// the totals at exit, unless that line was just written
+		if (frames % 60 != 0)
+			stats_dump(stats_file);
+
+		if (stats_file != stderr)
+			fclose(stats_file);
+	}
+
+	movie_close();
+	wav_close();
+	snapcache_close();
+
 	SDL_Quit();
 	exit(0);
 }
@@ -3,84 +3,124 @@
 #include "ppu.h"
 #include "cpu.h"
 #include "controller.h"
+#include "apu.h"
+#include "state.h"
+#include "idle.h"
+#include "system.h"
+#include "stats.h"
+
+CONSOLE_LOCAL uint8_t 	*ppu_memory;
+CONSOLE_LOCAL uint8_t 	*cpu_memory;
+CONSOLE_LOCAL uint8_t 	*prg_memory;
+CONSOLE_LOCAL uint8_t 	*primary_oam;
+CONSOLE_LOCAL uint8_t 	*secondary_oam;
+
+CONSOLE_LOCAL uint16_t 	ppu_read_buffer;
+CONSOLE_LOCAL uint8_t 	vram_increment = 1;	// PPUDATA address step, from PPUCTRL
+
+// The next block of arena, on a cache line of its own; NULL while measuring
+void* memory_take(uint8_t* arena, size_t* offset, size_t size)
+{
+	void* block = arena ? arena + *offset : NULL;
 
-uint8_t 	*ppu_memory;
-uint8_t 	*cpu_memory;
-uint8_t 	*primary_oam;
-
-uint16_t 	ppu_read_buffer;
+	*offset += (size + MEMORY_ALIGN - 1) & ~(size_t)(MEMORY_ALIGN - 1);
 
-struct 		CPU_Registers cpu_registers;
-struct 		PPU_Registers ppu_registers;
+	return block;
+}
 
-void memory_init()
+// Lays out every block a console works in one after another in arena and
+// initialises them, so a console is a single allocation and nothing is
+// allocated again while it runs. PRG goes in too unless the console shares a
+// cartridge's. With arena NULL it only measures, as the save functions do;
+// the arena must be MEMORY_ALIGN aligned.
+size_t memory_init(uint8_t* arena, bool prg)
 {
-	ppu_memory = malloc(0x4000);
-	if (ppu_memory != NULL)
-		memset(ppu_memory, 0, 0x4000);
+	size_t offset = 0;
+
+	ppu_memory = memory_take(arena, &offset, PPU_MEMORY_SIZE);
+	cpu_memory = memory_take(arena, &offset, CPU_MEMORY_SIZE);
+
+	// $8000-$FFFF, kept apart from cpu_memory so consoles can share one ROM,
+	// and with it the decode cache made from it
+	if (prg)
+	{
+		prg_memory = memory_take(arena, &offset, PRG_MEMORY_SIZE);
+		decode_cache = memory_take(arena, &offset, sizeof(struct Decode_Cache));
+	}
+
+	primary_oam = memory_take(arena, &offset, OAM_SIZE);
+	secondary_oam = memory_take(arena, &offset, OAM_SIZE);
+	tile_cache = memory_take(arena, &offset, sizeof(struct Tile_Cache));
+	screen = memory_take(arena, &offset, WIDTH * HEIGHT * CHANNELS);
+	apu_buffer = memory_take(arena, &offset, sizeof(struct APU_Buffer));
+	decode_stats = memory_take(arena, &offset, sizeof(struct Decode_Stats));
+	idle = memory_take(arena, &offset, sizeof(struct Idle));
+	host_stats = memory_take(arena, &offset, sizeof(struct Stats));
+
+	if (arena == NULL)
+		return offset;
+
+	memset(ppu_memory, 0, PPU_MEMORY_SIZE);
+	memset(cpu_memory, 0, CPU_MEMORY_SIZE);
+	if (prg)
+	{
+		memset(prg_memory, 0, PRG_MEMORY_SIZE);
+		memset(decode_cache->entries, 0, sizeof(decode_cache->entries));
+		pthread_mutex_init(&decode_cache->lock, NULL);
+	}
+	memset(primary_oam, 0xFF, OAM_SIZE);
+	memset(secondary_oam, 0xFF, OAM_SIZE);
+	memset(tile_cache->valid, 0, sizeof(tile_cache->valid));
+	memset(screen, 0, WIDTH * HEIGHT * CHANNELS);
+	memset(apu_buffer, 0, sizeof(struct APU_Buffer));
+	memset(decode_stats, 0, sizeof(struct Decode_Stats));
 
-	cpu_memory = malloc(0xFFFF);
-	if (cpu_memory != NULL)
-		memset(cpu_memory, 0, 0xFFFF);
+	memset(idle, 0, sizeof(struct Idle));
+	idle->enabled = true;
 
-	primary_oam = malloc(0xFF);
-	if (primary_oam != NULL)
-		memset(primary_oam, 0xFF, 0xFF);
+	stats_reset();
 
 	ppu_read_buffer = 0x0000;
+
+	return offset;
+}
+
+// Where each 1 KiB quadrant of $2000-$2FFF is kept in ppu_memory, relative
+// to its own address
+static const uint16_t nametable_offsets[2][4] = {
+	[Horizontal] 	= { 0x0000, 0x0000, 0x0400, 0x0400 },
+	[Vertical] 	= { 0x0000, 0x0400, 0x0000, 0x0400 },
+};
+
+// $2000-$3EFF, with $3000-$3EFF mirroring $2000-$2EFF
+static inline uint16_t nametable_address(uint16_t address)
+{
+	address = 0x2000 | (address & 0x0FFF);
+
+	return address + nametable_offsets[cartridge_mirroring][(address >> 10) & 0x3];
+}
+
+static inline uint16_t palette_address(uint16_t address)
+{
+	// the backdrop entries of the sprite palettes are those of the background
+	if ((address & 0xFFF3) == 0x3F10)
+		address &= ~0x0010;
+
+	return address;
 }
 
 uint8_t ppu_read(uint16_t address)
 {
-	uint8_t data = 0x00;
+	STAT_COUNT(ppu_reads[STAT_PPU_REGION(address)]);
 
 	if (address <= 0x1FFF)
-	{
-		data = ppu_memory[address];
-	}
-	else if (address >= 0x2000 && address <= 0x3EFF)
-	{
-		if (cartridge_mirroring == Horizontal)
-		{
-			if (address >= 0x3000)
-				address -= 0x1000;
-
-			if (address >= 0x2000 && address <= 0x23FF)
-				data = ppu_memory[address];
-			else if (address >= 0x2400 && address <= 0x27FF)
-				data = ppu_memory[address];
-			else if (address >= 0x2800 && address <= 0x2BFF)
-				data = ppu_memory[address + 0x0400];
-			else if (address >= 0x2C00 && address <= 0x2FFF)
-				data = ppu_memory[address + 0x0400];
-		}
-		else if (cartridge_mirroring == Vertical)
-		{
-			if (address >= 0x2000 && address <= 0x23FF)
-				data = ppu_memory[address];
-			else if (address >= 0x2400 && address <= 0x27FF)
-				data = ppu_memory[address + 0x0400];
-			else if (address >= 0x2800 && address <= 0x2BFF)
-				data = ppu_memory[address];
-			else if (address >= 0x2C00 && address <= 0x2FFF)
-				data = ppu_memory[address + 0x0400];
-		}
-	}
-	else if (address >= 0x3F00 && address <= 0x3FFF)
-	{
-		if (address == 0x3F10)
-			address = 0x3F00;
-		if (address == 0x3F14)
-			address = 0x3F04;
-		if (address == 0x3F18)
-			address = 0x3F08;
-		if (address == 0x3F1C)
-			address = 0x3F0C;
-
-		data = ppu_memory[address];
-	}
+		return ppu_memory[address];
+	else if (address <= 0x3EFF)
+		return ppu_memory[nametable_address(address)];
+	else if (address <= 0x3FFF)
+		return ppu_memory[palette_address(address)];
 
-	return data;
+	return 0x00;
 }
 
 void ppu_write(uint16_t address, uint8_t data)
@@ -88,75 +128,85 @@ void ppu_write(uint16_t address, uint8_t data)
 	if (address <= 0x1FFF)
 	{
 		ppu_memory[address] = data;
+		ppu_invalidate_tile(address);
 	}
-	else if (address >= 0x2000 && address <= 0x3EFF)
-	{
-		if (address >= 0x3000)
-			address -= 0x1000;
+	else if (address <= 0x3EFF)
+		ppu_memory[nametable_address(address)] = data;
+	else if (address <= 0x3FFF)
+		ppu_memory[palette_address(address)] = data;
+}
 
-		if (cartridge_mirroring == Horizontal)
-		{
-			if (address >= 0x2000 && address <= 0x23FF)
-				ppu_memory[address] = data;
-			else if (address >= 0x2400 && address <= 0x27FF)
-				ppu_memory[address] = data;
-			else if (address >= 0x2800 && address <= 0x2BFF)
-				ppu_memory[address + 0x0400] = data;
-			else if (address >= 0x2C00 && address <= 0x2FFF)
-				ppu_memory[address + 0x0400] = data;
-		}
-		else if (cartridge_mirroring == Vertical)
-		{
-			if (address >= 0x2000 && address <= 0x23FF)
-				ppu_memory[address] = data;
-			else if (address >= 0x2400 && address <= 0x27FF)
-				ppu_memory[address + 0x0400] = data;
-			else if (address >= 0x2800 && address <= 0x2BFF)
-				ppu_memory[address] = data;
-			else if (address >= 0x2C00 && address <= 0x2FFF)
-				ppu_memory[address + 0x0400] = data;
-		}
-	}
-	else if (address >= 0x3F00 && address <= 0x3FFF)
-	{
-		if (address == 0x3F10)
-			address = 0x3F00;
-		if (address == 0x3F14)
-			address = 0x3F04;
-		if (address == 0x3F18)
-			address = 0x3F08;
-		if (address == 0x3F1C)
-			address = 0x3F0C;
+// PPUDATA, with the increment PPUCTRL selects cached in vram_increment
+static inline uint8_t ppu_read_data()
+{
+	uint8_t data;
 
-		ppu_memory[address] = data;
+	if (ppu.v <= 0x3EFF)
+	{
+		data = ppu_read_buffer;
+		ppu_read_buffer = ppu_read(ppu.v);
 	}
+	else
+		data = ppu_read(ppu.v);
+
+	ppu.v = (ppu.v + vram_increment) & 0x7FFF;
+
+	return data;
 }
 
-void set_ppu_flag(uint16_t reg, uint8_t flag, bool condition)
+static inline void ppu_write_data(uint8_t data)
 {
-	uint8_t r = cpu_memory[reg];
-
-	if (condition)
-		r |= flag;
-	else
-		r &= ~flag;
+	ppu_write(ppu.v, data);
+	ppu.v = (ppu.v + vram_increment) & 0x7FFF;
+}
 
-	cpu_memory[reg] = r;
+// With rendering off the PPU reads nothing but the backdrop colour, so a
+// PPUDATA access below the palettes may then happen off its exact cycle,
+// e.g. inside a JIT block or a run of predecoded instructions uploading a
+// nametable. Only a $2001 write can turn rendering back on, and that is I/O.
+bool ppu_data_deferrable(uint16_t address)
+{
+	return (address & 0xE007) == 0x2007 && ppu.v < 0x3F00 &&
+		ppu.render_mode == Render_Off;
 }
 
-bool is_ppu_flag_set(uint16_t reg, uint8_t flag)
+// Sprite DMA: copies a page into OAM, starting at OAMADDR, and halts the
+// CPU for the 513 cycles it takes (514 if it starts on an odd cycle). Only
+// pages with side effects on read go byte by byte.
+static void oam_dma(uint8_t page)
 {
-	uint8_t r = cpu_memory[reg];
-	return r & flag;
+	uint8_t buffer[256];
+	const uint8_t* source;
+
+	if (page < 0x20)
+		source = cpu_memory + (page << 8);
+	else if (page >= 0x80)
+		source = prg_memory + ((page << 8) & 0x7FFF);
+	else
+	{
+		for (uint16_t i = 0; i <= 255; i++)
+			buffer[i] = cpu_read((page << 8) | i);
+
+		source = buffer;
+	}
+
+	uint8_t start = ppu.oam_address;
+
+	memcpy(primary_oam + start, source, 256 - start);
+	memcpy(primary_oam, source + 256 - start, start);
+
+	cpu.dma_cycles = 513 + (cpu_cycle_count & 1);
 }
 
 uint8_t cpu_read(uint16_t address)
 {
 	uint8_t data = 0x00;
 
+	STAT_COUNT(cpu_reads[STAT_REGION(address)]);
+
 	if (address >= 0x8000 && address <= 0xFFFF)
 	{
-		data = cpu_memory[address];
+		data = prg_memory[address & 0x7FFF];
 	}
 	else if (address <= 0x1FFF)
 	{
@@ -166,6 +216,8 @@ uint8_t cpu_read(uint16_t address)
 	{
 		address &= 0x2007;
 
+		STAT_COUNT(ppu_register_reads[address & 0x7]);
+
 		switch (address)
 		{
 			case (0x2000): // control
@@ -173,31 +225,30 @@ uint8_t cpu_read(uint16_t address)
 			case (0x2001): // mask
 				break;
 			case (0x2002): // status
-				data = (cpu_memory[0x2002] & 0xE0) | (ppu_read_buffer & 0x1F);
+				data = (ppu.status & 0xE0) | (ppu_read_buffer & 0x1F);
 
-				ppu_registers.w = 0;
-				set_ppu_flag(PPUSTATUS, PPUSTATUS_FLAG_V, false);
+				ppu.w = 0;
+				ppu.status &= ~PPUSTATUS_FLAG_V;
 
 				break;
 			case (0x2006): // address
 				break;
 			case (0x2007): // data
-				if (ppu_registers.v <= 0x3EFF)
-				{
-					data = ppu_read_buffer;
-					ppu_read_buffer = ppu_read(ppu_registers.v);
-				}
-				else if (ppu_registers.v >= 0x3F00 && ppu_registers.v <= 0x3FFF)
-					data = ppu_read(ppu_registers.v);
-
-				ppu_registers.v += (is_ppu_flag_set(PPUCTRL, PPUCTRL_FLAG_I) ? 32 : 1);
-
+				data = ppu_read_data();
 				break;
 		}
 	}
+	else if (address == 0x4015)
+	{
+		data = apu_read_status();
+	}
 	else if (address == 0x4016)
 	{
-		data = read_controller();
+		data = read_controller(0);
+	}
+	else if (address == 0x4017)
+	{
+		data = read_controller(1);
 	}
 
 	return data;
@@ -205,10 +256,12 @@ uint8_t cpu_read(uint16_t address)
 
 void cpu_write(uint16_t address, uint8_t data)
 {
+	STAT_COUNT(cpu_writes[STAT_REGION(address)]);
+
 	// cartridge mapping
 	if (address >= 0x8000 && address <= 0xFFFF)
 	{
-		cpu_memory[address] = data;
+		// PRG is ROM, possibly shared between consoles
 	}
 	else if (address <= 0x1FFF)
 	{
@@ -218,100 +271,121 @@ void cpu_write(uint16_t address, uint8_t data)
 	{
 		address &= 0x2007;
 
+		STAT_COUNT(ppu_register_writes[address & 0x7]);
+
 		// write
 		switch (address)
 		{
 			case (0x2000): // control
-				ppu_registers.t &= ~0x0C00;
-				ppu_registers.t |= (((uint16_t)data & 0x3) << 10);
+				ppu.t &= ~0x0C00;
+				ppu.t |= (((uint16_t)data & 0x3) << 10);
 
-				cpu_memory[PPUCTRL] = data;
+				ppu.control = data;
+				vram_increment = (data & PPUCTRL_FLAG_I) ? 32 : 1;
+				ppu_set_control(data);
 
 				break;
 			case (0x2001): // mask
-				cpu_memory[PPUMASK] = data;
+				ppu.mask = data;
+				ppu_set_mask(data);
 				break;
 			case (0x2002): // status
-				cpu_memory[PPUSTATUS] = (cpu_memory[PPUSTATUS] & 0x80) | (data & 0x3F);
+				ppu.status = (ppu.status & 0x80) | (data & 0x3F);
 				
 				break;
 			case (0x2003):
-				cpu_memory[OAMADDR] = data;
+				ppu.oam_address = data;
 				break;
 			case (0x2004):
-				primary_oam[ cpu_memory[OAMADDR] ] = data;
-				cpu_memory[OAMADDR] += 1;
+				primary_oam[ppu.oam_address] = data;
+				ppu.oam_address++;
 				break;
 			case (0x2005):
-				if (ppu_registers.w == 0)
+				if (ppu.w == 0)
 				{
 					// update fine x
-					ppu_registers.x = data & 0x07;
+					ppu.x = data & 0x07;
 
 					// update coarse x
-					ppu_registers.t = (ppu_registers.t & ~0x001F) | ((uint16_t)data >> 3);
+					ppu.t = (ppu.t & ~0x001F) | ((uint16_t)data >> 3);
 				}
 				else
 				{
 					// update fine y
-					ppu_registers.t = (ppu_registers.t & ~0x7000) | (((uint16_t)data & 0x7) << 12);
+					ppu.t = (ppu.t & ~0x7000) | (((uint16_t)data & 0x7) << 12);
 
 					// update coarse y
-					ppu_registers.t = (ppu_registers.t & ~0x03E0) | (((uint16_t)data >> 3) << 5);
+					ppu.t = (ppu.t & ~0x03E0) | (((uint16_t)data >> 3) << 5);
 				}
 
-				ppu_registers.w ^= 1;
+				ppu.w ^= 1;
 
 				break;
 			case (0x2006): // address
-				if (ppu_registers.w == 0)
+				if (ppu.w == 0)
 				{
-					ppu_registers.t = (ppu_registers.t & 0x00FF) | (((uint16_t)data & 0x3F) << 8);
+					ppu.t = (ppu.t & 0x00FF) | (((uint16_t)data & 0x3F) << 8);
 
 					// set bit 14 to 0
-					ppu_registers.t = (ppu_registers.t & ~0x4000);
+					ppu.t = (ppu.t & ~0x4000);
 				}
 				else
 				{
-					ppu_registers.t = (ppu_registers.t & 0xFF00) | (uint16_t)data;
-					ppu_registers.v = ppu_registers.t;
+					ppu.t = (ppu.t & 0xFF00) | (uint16_t)data;
+					ppu.v = ppu.t;
 				}
 
-				ppu_registers.w ^= 1;
+				ppu.w ^= 1;
 					
 				break;
 			case (0x2007): // data
-				ppu_write(ppu_registers.v, data);
-
-				ppu_registers.v += (is_ppu_flag_set(PPUCTRL, PPUCTRL_FLAG_I) ? 32 : 1);
-
+				ppu_write_data(data);
 				break;
 		}
 	}
 	else if (address == 0x4014)
 	{
-		uint16_t oam_address = ((uint16_t)data << 8) | (cpu_memory[OAMADDR] << 8);
-		for (uint16_t i = 0; i <= 255; i++)
-		{
-			uint8_t data = cpu_read(oam_address + i);
-			primary_oam[i] = data;
-		}
+		oam_dma(data);
 	}
 	else if (address == 0x4016)
 	{
 		write_controller(data);
 	}
+	else if ((address >= 0x4000 && address <= 0x4013) || address == 0x4015 || address == 0x4017)
+	{
+		apu_write(address, data);
+	}
 }
 
 void set_cpu_flag(uint8_t flag, bool condition)
 {
 	if (condition)
-		cpu_registers.p |= flag;
+		cpu.p |= flag;
 	else
-		cpu_registers.p &= ~flag;
+		cpu.p &= ~flag;
 }
 
 bool is_cpu_flag_set(uint8_t flag)
 {
-	return cpu_registers.p & flag;
+	return cpu.p & flag;
+}
+
+size_t memory_save_state(uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	SAVE_STATE(buffer, offset, ppu_read_buffer);
+	SAVE_STATE(buffer, offset, vram_increment);
+
+	return offset;
+}
+
+size_t memory_load_state(const uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	LOAD_STATE(buffer, offset, ppu_read_buffer);
+	LOAD_STATE(buffer, offset, vram_increment);
+
+	return offset;
 }
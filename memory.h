@@ -3,23 +3,32 @@
 #include <string.h>
 #include <stdbool.h>
 
-void 		memory_init();
+#include "console.h"
+
+#define CPU_MEMORY_SIZE 0x8000
+#define PRG_MEMORY_SIZE 0x8000
+#define PPU_MEMORY_SIZE 0x4000
+#define OAM_SIZE 0x100
+#define MEMORY_ALIGN 64
+
+void* 		memory_take(uint8_t* arena, size_t* offset, size_t size);
+size_t 		memory_init(uint8_t* arena, bool prg);
+
+size_t 		memory_save_state(uint8_t* buffer);
+size_t 		memory_load_state(const uint8_t* buffer);
 
 uint8_t 	cpu_read(uint16_t address);
 void 		cpu_write(uint16_t address, uint8_t data);
 
 uint8_t 	ppu_read(uint16_t address);
 void 		ppu_write(uint16_t address, uint8_t data);
+bool 		ppu_data_deferrable(uint16_t address);
 
 void 		set_cpu_flag(uint8_t flag, bool condition);
 bool 		is_cpu_flag_set(uint8_t flag);
 
-bool 		is_ppu_flag_set(uint16_t reg, uint8_t flag);
-void 		set_ppu_flag(uint16_t reg, uint8_t flag, bool condition);
-
-extern uint8_t*	cpu_memory;
-extern uint8_t*	ppu_memory;
-extern uint8_t*	primary_oam;
-
-extern struct 	CPU_Registers cpu_registers;
-extern struct 	PPU_Registers ppu_registers;
+extern CONSOLE_LOCAL uint8_t*	cpu_memory;
+extern CONSOLE_LOCAL uint8_t*	prg_memory;
+extern CONSOLE_LOCAL uint8_t*	ppu_memory;
+extern CONSOLE_LOCAL uint8_t*	primary_oam;
+extern CONSOLE_LOCAL uint8_t*	secondary_oam;
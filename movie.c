@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "movie.h"
+#include "cartridge.h"
+#include "controller.h"
+
+enum movie_mode movie_mode;
+
+FILE* 		movie_stream;
+struct 		Movie_Header movie_header;
+uint32_t 	movie_position;
+uint8_t* 	movie_data;
+uint8_t 	movie_input[MOVIE_MAX_PORTS];
+
+int movie_record(char* filename)
+{
+	movie_stream = fopen(filename, "wb");
+
+	if (movie_stream == NULL)
+		return 1;
+
+	memset(&movie_header, 0, sizeof(struct Movie_Header));
+	memcpy(movie_header.id, "NESM", 4);
+	movie_header.version = MOVIE_VERSION;
+	movie_header.ports = CONTROLLER_PORTS;
+	movie_header.rom_hash = cartridge_hash;
+
+	// frame count is patched in by movie_close()
+	fwrite(&movie_header, sizeof(struct Movie_Header), 1, movie_stream);
+
+	movie_position = 0;
+	movie_mode = Movie_Record;
+
+	return 0;
+}
+
+int movie_play(char* filename)
+{
+	movie_stream = fopen(filename, "rb");
+
+	if (movie_stream == NULL)
+		return 1;
+
+	if (fread(&movie_header, sizeof(struct Movie_Header), 1, movie_stream) != 1 ||
+	    memcmp(movie_header.id, "NESM", 4) != 0 ||
+	    movie_header.version != MOVIE_VERSION ||
+	    movie_header.ports == 0 || movie_header.ports > MOVIE_MAX_PORTS)
+	{
+		printf("Invalid movie file\n");
+		fclose(movie_stream);
+		return 1;
+	}
+
+	if (movie_header.rom_hash != cartridge_hash)
+	{
+		printf("Movie was recorded with a different ROM (%016llX)\n", (unsigned long long)movie_header.rom_hash);
+		fclose(movie_stream);
+		return 1;
+	}
+
+	// read up front, so the input ahead is known (see snapcache_resume())
+	movie_data = malloc((size_t)movie_header.frames * movie_header.ports + 1);
+
+	if (movie_data == NULL)
+	{
+		fclose(movie_stream);
+		return 1;
+	}
+
+	movie_header.frames = fread(movie_data, movie_header.ports, movie_header.frames, movie_stream);
+
+	movie_position = 0;
+	movie_mode = Movie_Play;
+	input_backend = Input_Movie;
+
+	return 0;
+}
+
+// Called once per frame before it is emulated. During playback this latches
+// the recorded input into the controller ports and returns false once the
+// movie has run out; during recording it appends whatever the active input
+// backend latched.
+bool movie_frame()
+{
+	switch (movie_mode)
+	{
+		case Movie_Play:
+			if (movie_position >= movie_header.frames)
+				return false;
+
+			memcpy(movie_input, &movie_data[movie_position * movie_header.ports], movie_header.ports);
+
+			for (uint8_t i = 0; i < movie_header.ports && i < CONTROLLER_PORTS; i++)
+				set_controller_state(i, movie_input[i]);
+
+			movie_position++;
+
+			break;
+		case Movie_Record:
+			for (uint8_t i = 0; i < movie_header.ports; i++)
+				movie_input[i] = controller_ports[i].state;
+
+			fwrite(movie_input, movie_header.ports, 1, movie_stream);
+			movie_position++;
+
+			break;
+		case Movie_Off:
+			break;
+	}
+
+	return true;
+}
+
+// Playback carries on from this frame, as after a resumed snapshot
+void movie_seek(uint32_t frame)
+{
+	if (movie_mode == Movie_Play && frame <= movie_header.frames)
+		movie_position = frame;
+}
+
+void movie_close()
+{
+	if (movie_mode == Movie_Record)
+	{
+		movie_header.frames = movie_position;
+
+		fseek(movie_stream, 0, SEEK_SET);
+		fwrite(&movie_header, sizeof(struct Movie_Header), 1, movie_stream);
+	}
+
+	if (movie_mode != Movie_Off)
+		fclose(movie_stream);
+
+	free(movie_data);
+	movie_data = NULL;
+
+	movie_mode = Movie_Off;
+}
@@ -0,0 +1,29 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MOVIE_VERSION 1
+#define MOVIE_MAX_PORTS 4
+
+enum 		movie_mode { Movie_Off, Movie_Record, Movie_Play };
+extern enum 	movie_mode movie_mode;
+
+struct Movie_Header
+{
+	char 		id[4];		// "NESM"
+	uint8_t 	version;
+	uint8_t 	ports;		// controller bytes stored per frame
+	uint8_t 	unused[2];
+	uint64_t 	rom_hash;	// cartridge_hash of the recorded ROM
+	uint32_t 	frames;
+	uint32_t 	reserved;
+};
+
+extern struct 	Movie_Header movie_header;
+extern uint8_t* movie_data;		// every frame's input, when playing
+extern uint8_t 	movie_input[MOVIE_MAX_PORTS];	// the frame just latched or recorded
+
+int 	movie_record(char* filename);
+int 	movie_play(char* filename);
+bool 	movie_frame();
+void 	movie_seek(uint32_t frame);
+void 	movie_close();
@@ -0,0 +1,617 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "nes.h"
+#include "system.h"
+#include "memory.h"
+#include "ppu.h"
+#include "cartridge.h"
+#include "controller.h"
+#include "state.h"
+#include "apu.h"
+#include "trace.h"
+#include "cpu.h"
+#include "jit.h"
+#include "idle.h"
+#include "stats.h"
+#include "profile.h"
+#include "export.h"
+
+// ROM contents, shared by every console created from the same load
+struct NES_Cartridge
+{
+	int 			references;
+	uint8_t*		prg_memory;
+	uint8_t			chr_memory[0x2000];
+	enum mirroring_mode 	mirroring;
+	uint64_t 		hash;
+	struct JIT*		jit;		// compiled PRG, if a console asked for one
+	struct Decode_Cache	decode_cache;	// decoded PRG
+};
+
+struct NES
+{
+	struct NES_Cartridge*	cartridge;
+
+	uint8_t*	cpu_memory;
+	uint8_t*	ppu_memory;
+	uint8_t*	primary_oam;
+	uint8_t*	secondary_oam;
+	uint8_t*	screen;
+	struct Tile_Cache*	tile_cache;
+	struct APU_Buffer*	apu_buffer;
+	struct Trace*		trace;
+	struct Profile*		profile;
+	struct Export*		export;
+	struct Decode_Stats*	decode_stats;
+	struct Idle*		idle;
+	struct Stats*		stats;
+	bool		use_jit;
+	enum tv_system	region;		// for consoles created from this one
+	int		frame_skip;	// draw one frame in this many
+	int		skipped;	// frames not drawn since the last that was
+
+	uint8_t*	context;	// this console's globals while another one is active
+};
+
+static CONSOLE_LOCAL struct NES* 	active_nes;
+static uint8_t* 			initial_context;
+static size_t 				context_size;
+
+static void nes_deactivate()
+{
+	if (active_nes != NULL)
+		state_save_context(active_nes->context);
+
+	active_nes = NULL;
+}
+
+// Parks whatever console this thread has live so another thread may run it.
+void nes_detach()
+{
+	nes_deactivate();
+}
+
+static struct NES_Cartridge* cartridge_create()
+{
+	struct NES_Cartridge* cartridge = calloc(1, sizeof(struct NES_Cartridge));
+
+	if (cartridge == NULL)
+		return NULL;
+
+	cartridge->prg_memory = calloc(1, PRG_MEMORY_SIZE);
+
+	if (cartridge->prg_memory == NULL)
+	{
+		free(cartridge);
+		return NULL;
+	}
+
+	cartridge->references = 1;
+	pthread_mutex_init(&cartridge->decode_cache.lock, NULL);
+
+	return cartridge;
+}
+
+static void cartridge_release(struct NES_Cartridge* cartridge)
+{
+	if (cartridge != NULL && --cartridge->references == 0)
+	{
+		jit_destroy(cartridge->jit);
+		pthread_mutex_destroy(&cartridge->decode_cache.lock);
+		free(cartridge->prg_memory);
+		free(cartridge);
+	}
+}
+
+static void nes_activate(struct NES* nes)
+{
+	if (active_nes == nes)
+		return;
+
+	nes_deactivate();
+
+	cpu_memory = nes->cpu_memory;
+	prg_memory = nes->cartridge->prg_memory;
+	ppu_memory = nes->ppu_memory;
+	primary_oam = nes->primary_oam;
+	secondary_oam = nes->secondary_oam;
+	screen = nes->screen;
+	tile_cache = nes->tile_cache;
+	apu_buffer = nes->apu_buffer;
+	trace = nes->trace;
+	profile = nes->profile;
+	frame_export = nes->export;
+	decode_cache = &nes->cartridge->decode_cache;
+	decode_stats = nes->decode_stats;
+	idle = nes->idle;
+	host_stats = nes->stats;
+	jit = nes->use_jit ? nes->cartridge->jit : NULL;
+
+	state_load_context(nes->context);
+
+	active_nes = nes;
+}
+
+nes_t* nes_create()
+{
+	nes_deactivate();
+
+	// snapshot the untouched globals once so every console starts identically
+	if (initial_context == NULL)
+	{
+		context_size = state_save_context(NULL);
+		initial_context = malloc(context_size);
+
+		if (initial_context == NULL)
+			return NULL;
+
+		state_save_context(initial_context);
+	}
+
+	// The console, its memory blocks and its parked globals are one
+	// allocation, made here and nowhere else; PRG is the cartridge's.
+	size_t size = 0;
+
+	memory_take(NULL, &size, sizeof(struct NES));
+	size += memory_init(NULL, false);
+	memory_take(NULL, &size, context_size);
+
+	uint8_t* arena = aligned_alloc(MEMORY_ALIGN, size);
+
+	if (arena == NULL)
+		return NULL;
+
+	size_t offset = 0;
+	struct NES* nes = memory_take(arena, &offset, sizeof(struct NES));
+
+	memset(nes, 0, sizeof(struct NES));
+	offset += memory_init(arena + offset, false);
+	nes->context = memory_take(arena, &offset, context_size);
+	nes->cartridge = cartridge_create();
+
+	nes->cpu_memory = cpu_memory;
+	nes->ppu_memory = ppu_memory;
+	nes->primary_oam = primary_oam;
+	nes->secondary_oam = secondary_oam;
+	nes->screen = screen;
+	nes->tile_cache = tile_cache;
+	nes->apu_buffer = apu_buffer;
+	nes->decode_stats = decode_stats;
+	nes->idle = idle;
+	nes->stats = host_stats;
+
+	if (nes->cartridge == NULL)
+	{
+		nes_destroy(nes);
+		return NULL;
+	}
+
+	nes->frame_skip = 1;
+
+	memcpy(nes->context, initial_context, context_size);
+	nes_activate(nes);
+
+	input_backend = Input_API;
+
+	return nes;
+}
+
+void nes_destroy(nes_t* nes)
+{
+	if (nes == NULL)
+		return;
+
+	if (active_nes == nes)
+		active_nes = NULL;
+
+	cartridge_release(nes->cartridge);
+
+	if (nes->trace != NULL)
+	{
+		free(nes->trace->records);
+		free(nes->trace);
+	}
+
+	free(nes->profile);
+	export_destroy(nes->export);
+
+	// and with it every block memory_init() laid out
+	free(nes);
+}
+
+// A console about to load a ROM must not scribble over a PRG it shares.
+static int nes_own_cartridge(nes_t* nes)
+{
+	if (nes->cartridge->references > 1)
+	{
+		struct NES_Cartridge* cartridge = cartridge_create();
+
+		if (cartridge == NULL)
+			return 1;
+
+		cartridge_release(nes->cartridge);
+		nes->cartridge = cartridge;
+
+		if (active_nes == nes)
+		{
+			prg_memory = cartridge->prg_memory;
+			decode_cache = &cartridge->decode_cache;
+			jit = NULL;
+		}
+	}
+
+	nes_activate(nes);
+
+	return 0;
+}
+
+static void nes_capture_cartridge(nes_t* nes)
+{
+	memcpy(nes->cartridge->chr_memory, ppu_memory, 0x2000);
+	nes->cartridge->mirroring = cartridge_mirroring;
+	nes->cartridge->hash = cartridge_hash;
+	nes->region = tv_system;
+
+	// blocks compiled from the previous ROM
+	jit_flush(nes->cartridge->jit);
+
+	if (nes->use_jit)
+		nes_set_jit(nes, 1);
+}
+
+int nes_load_rom_memory(nes_t* nes, const uint8_t* data, size_t size)
+{
+	if (nes_own_cartridge(nes) != 0 || load_cartridge_memory(data, size) != 0)
+		return 1;
+
+	nes_capture_cartridge(nes);
+	system_reset();
+
+	return 0;
+}
+
+int nes_load_rom(nes_t* nes, const char* filename)
+{
+	if (nes_own_cartridge(nes) != 0 || load_cartridge((char*)filename) != 0)
+		return 1;
+
+	nes_capture_cartridge(nes);
+	system_reset();
+
+	return 0;
+}
+
+nes_t* nes_create_from(nes_t* source)
+{
+	nes_t* nes = nes_create();
+
+	if (nes == NULL)
+		return NULL;
+
+	cartridge_release(nes->cartridge);
+	nes->cartridge = source->cartridge;
+	nes->cartridge->references++;
+
+	prg_memory = nes->cartridge->prg_memory;
+	decode_cache = &nes->cartridge->decode_cache;
+	memcpy(ppu_memory, nes->cartridge->chr_memory, 0x2000);
+	cartridge_mirroring = nes->cartridge->mirroring;
+	cartridge_hash = nes->cartridge->hash;
+
+	nes->use_jit = source->use_jit;
+	jit = nes->use_jit ? nes->cartridge->jit : NULL;
+
+	nes->region = source->region;
+	tv_system = nes->region;
+
+	system_reset();
+
+	return nes;
+}
+
+void nes_reset(nes_t* nes)
+{
+	nes_activate(nes);
+	system_reset();
+}
+
+void nes_power_cycle(nes_t* nes)
+{
+	nes_activate(nes);
+
+	state_load_context(initial_context);
+
+	memset(cpu_memory, 0, CPU_MEMORY_SIZE);
+	memcpy(ppu_memory, nes->cartridge->chr_memory, 0x2000);
+	memset(ppu_memory + 0x2000, 0, PPU_MEMORY_SIZE - 0x2000);
+	memset(primary_oam, 0xFF, OAM_SIZE);
+	memset(secondary_oam, 0xFF, OAM_SIZE);
+
+	// the snapshot predates the ROM
+	cartridge_mirroring = nes->cartridge->mirroring;
+	cartridge_hash = nes->cartridge->hash;
+	tv_system = nes->region;
+
+	system_reset();
+}
+
+int nes_get_region(nes_t* nes)
+{
+	return nes->region;
+}
+
+void nes_set_region(nes_t* nes, int region)
+{
+	if (region < NES_REGION_NTSC || region > NES_REGION_DENDY)
+		return;
+
+	nes_activate(nes);
+
+	nes->region = region;
+	tv_system = region;
+
+	system_reset();
+}
+
+void nes_step_frame(nes_t* nes)
+{
+	nes_activate(nes);
+
+	// the last of every frame_skip frames is drawn; the others leave the
+	// previous picture in place
+	skip_pixels = ++nes->skipped < nes->frame_skip;
+
+	if (!skip_pixels)
+	{
+		nes->skipped = 0;
+		memset(screen, 0, WIDTH * HEIGHT * CHANNELS);
+	}
+
+	system_step_frame();
+
+	if (frame_export != NULL)
+		export_publish();
+}
+
+void nes_step_instruction(nes_t* nes)
+{
+	nes_activate(nes);
+
+	skip_pixels = false;
+	system_step_instruction();
+
+	// a frame finished on the way; close it as nes_step_frame() would
+	if (frame_complete)
+	{
+		frame_complete = false;
+		apu_end_frame();
+
+		if (frame_export != NULL)
+			export_publish();
+	}
+}
+
+void nes_get_cpu(nes_t* nes, nes_cpu_t* state)
+{
+	nes_activate(nes);
+
+	state->pc = cpu.pc;
+	state->a = cpu.a;
+	state->x = cpu.x;
+	state->y = cpu.y;
+	state->p = cpu.p;
+	state->sp = cpu.sp;
+	state->cycle = cpu_cycle_count;
+	state->scanline = ppu.scanline;
+	state->dot = ppu.cycle;
+}
+
+void nes_set_cpu(nes_t* nes, const nes_cpu_t* state)
+{
+	nes_activate(nes);
+
+	cpu.pc = state->pc;
+	cpu.a = state->a;
+	cpu.x = state->x;
+	cpu.y = state->y;
+	cpu.p = state->p;
+	cpu.sp = state->sp;
+
+	idle_reset();
+}
+
+void nes_set_input(nes_t* nes, uint8_t port, uint8_t buttons)
+{
+	nes_activate(nes);
+	set_controller_state(port, buttons);
+}
+
+const uint8_t* nes_get_framebuffer(nes_t* nes)
+{
+	return nes->screen;
+}
+
+const uint8_t* nes_get_ram(nes_t* nes)
+{
+	return nes->cpu_memory;
+}
+
+size_t nes_get_audio(nes_t* nes, const int16_t** samples)
+{
+	*samples = nes->apu_buffer->samples;
+	return nes->apu_buffer->sample_count;
+}
+
+// Consoles on one cartridge share its compiled code, so the first to ask pays
+// for the translation. Returns nonzero if this platform has no JIT.
+int nes_set_jit(nes_t* nes, int enabled)
+{
+	nes_activate(nes);
+
+	nes->use_jit = enabled;
+	jit = NULL;
+
+	if (!enabled)
+		return 0;
+
+	if (nes->cartridge->jit == NULL)
+		nes->cartridge->jit = jit_create();
+
+	jit = nes->cartridge->jit;
+	nes->use_jit = jit != NULL;
+
+	return jit == NULL;
+}
+
+void nes_set_frame_skip(nes_t* nes, int factor)
+{
+	nes->frame_skip = factor > 1 ? factor : 1;
+	nes->skipped = 0;
+}
+
+void nes_get_decode_stats(nes_t* nes, nes_decode_stats_t* stats)
+{
+	stats->hits = nes->decode_stats->hits;
+	stats->misses = nes->decode_stats->misses;
+	stats->fallbacks = nes->decode_stats->fallbacks;
+}
+
+void nes_set_idle_skip(nes_t* nes, int enabled)
+{
+	nes->idle->enabled = enabled;
+}
+
+void nes_get_idle_stats(nes_t* nes, nes_idle_stats_t* stats)
+{
+	nes_activate(nes);
+
+	stats->skipped_cycles = idle->skipped_cycles;
+	stats->skips = idle->skips;
+	stats->total_cycles = cpu_cycle_count;
+}
+
+int nes_get_stats(nes_t* nes, nes_stats_t* stats)
+{
+	struct Stats* s = nes->stats;
+
+	stats->interpreted = s->interpreted;
+	stats->predecoded = s->predecoded;
+	stats->jit_blocks = s->jit_blocks;
+	stats->idle_stalls = s->idle_stalls;
+	memcpy(stats->cpu_reads, s->cpu_reads, sizeof(stats->cpu_reads));
+	memcpy(stats->cpu_writes, s->cpu_writes, sizeof(stats->cpu_writes));
+	memcpy(stats->ppu_reads, s->ppu_reads, sizeof(stats->ppu_reads));
+	memcpy(stats->ppu_register_reads, s->ppu_register_reads, sizeof(stats->ppu_register_reads));
+	memcpy(stats->ppu_register_writes, s->ppu_register_writes, sizeof(stats->ppu_register_writes));
+	stats->sprite_evaluations = s->sprite_evaluations;
+	stats->sprite_overflows = s->sprite_overflows;
+	stats->frames = s->timed[Timer_Frame];
+	stats->frame_seconds = s->ticks[Timer_Frame] ? s->ticks[Timer_Frame] / stats_ticks_per_second() : 0;
+	stats->apu_seconds = s->ticks[Timer_APU] ? s->ticks[Timer_APU] / stats_ticks_per_second() : 0;
+
+#ifdef NESEMU_STATS
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+void nes_set_illegal_exit(int enabled)
+{
+	cpu_illegal_exit = enabled;
+}
+
+int nes_trace_start(nes_t* nes, size_t records)
+{
+	nes_activate(nes);
+
+	int result = trace_start(records);
+	nes->trace = trace;
+
+	return result;
+}
+
+void nes_trace_stop(nes_t* nes)
+{
+	nes_activate(nes);
+
+	trace_stop();
+	nes->trace = NULL;
+}
+
+int nes_trace_dump(nes_t* nes, const char* filename)
+{
+	nes_activate(nes);
+
+	return trace_dump(filename);
+}
+
+int nes_profile_start(nes_t* nes)
+{
+	nes_activate(nes);
+
+	int result = profile_start();
+	nes->profile = profile;
+
+	return result;
+}
+
+void nes_profile_stop(nes_t* nes)
+{
+	nes_activate(nes);
+
+	profile_stop();
+	nes->profile = NULL;
+}
+
+int nes_profile_report(nes_t* nes, const char* filename)
+{
+	nes_activate(nes);
+
+	return profile_report(filename);
+}
+
+int nes_export_start(nes_t* nes, const char* name)
+{
+	nes_activate(nes);
+
+	int result = export_start(name);
+	nes->export = frame_export;
+
+	return result;
+}
+
+void nes_export_stop(nes_t* nes)
+{
+	nes_activate(nes);
+
+	export_stop();
+	nes->export = NULL;
+}
+
+size_t nes_state_size()
+{
+	return state_save(NULL);
+}
+
+// Returns the number of bytes written, or 0 if the buffer is too small.
+size_t nes_save_state(nes_t* nes, uint8_t* buffer, size_t size)
+{
+	if (size < nes_state_size())
+		return 0;
+
+	nes_activate(nes);
+
+	return state_save(buffer);
+}
+
+int nes_load_state(nes_t* nes, const uint8_t* buffer, size_t size)
+{
+	if (size < nes_state_size())
+		return 1;
+
+	nes_activate(nes);
+
+	return state_load(buffer) == 0;
+}
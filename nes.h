@@ -0,0 +1,165 @@
+#include <stdint.h>
+#include <stddef.h>
+
+// Embedding API. Consoles share the emulator's globals and are swapped in on
+// demand, so switching between instances costs a small register copy while
+// repeated calls on the same instance cost nothing. The globals are
+// thread-local, so different threads may run different consoles at once,
+// but a console must never be used from two threads: whichever thread last
+// ran it holds its live state. Only the nes_batch_* functions move consoles
+// between threads, parking them first.
+
+#if defined(__GNUC__)
+#define NES_API __attribute__((visibility("default")))
+#else
+#define NES_API
+#endif
+
+#define NES_WIDTH 	256
+#define NES_HEIGHT 	240
+#define NES_RAM_SIZE 	0x800
+#define NES_PORTS 	2
+#define NES_SAMPLE_RATE 44100
+
+#define NES_REGION_NTSC 	0
+#define NES_REGION_PAL 		1
+#define NES_REGION_DENDY 	2
+
+typedef struct NES nes_t;
+typedef struct NES_Batch nes_batch_t;
+
+typedef struct nes_cpu
+{
+	uint16_t	pc;
+	uint8_t		a;
+	uint8_t		x;
+	uint8_t		y;
+	uint8_t		p;
+	uint8_t		sp;
+	uint64_t	cycle;		// CPU cycles since power on
+	uint16_t	scanline;
+	uint16_t	dot;
+} nes_cpu_t;
+
+typedef struct nes_decode_stats
+{
+	uint64_t	hits;		// PRG-ROM instructions run predecoded
+	uint64_t	misses;		// instructions decoded into the cache
+	uint64_t	fallbacks;	// cached instructions that needed the interpreter for I/O
+} nes_decode_stats_t;
+
+typedef struct nes_idle_stats
+{
+	uint64_t	skipped_cycles;	// spent stalled in place of polling loop passes
+	uint64_t	skips;
+	uint64_t	total_cycles;
+} nes_idle_stats_t;
+
+typedef struct nes_stats
+{
+	uint64_t	interpreted;		// instructions through the opcode switch
+	uint64_t	predecoded;		// ...and through the decode cache
+	uint64_t	jit_blocks;
+	uint64_t	idle_stalls;
+	uint64_t	cpu_reads[4];		// RAM, PPU registers, $4000-$7FFF, PRG-ROM
+	uint64_t	cpu_writes[4];
+	uint64_t	ppu_reads[3];		// pattern tables, nametables, palettes
+	uint64_t	ppu_register_reads[8];	// $2000-$2007
+	uint64_t	ppu_register_writes[8];
+	uint64_t	sprite_evaluations;	// scanlines
+	uint64_t	sprite_overflows;
+	uint64_t	frames;
+	double		frame_seconds;		// spent stepping them, in total
+	double		apu_seconds;		// of which in sound synthesis
+} nes_stats_t;
+
+NES_API nes_t* 		nes_create();
+NES_API void 		nes_destroy(nes_t* nes);
+
+// a new console, reset, running the ROM already loaded into source; the
+// read-only PRG is shared rather than copied
+NES_API nes_t* 		nes_create_from(nes_t* source);
+
+NES_API int 		nes_load_rom(nes_t* nes, const char* filename);
+NES_API int 		nes_load_rom_memory(nes_t* nes, const uint8_t* data, size_t size);
+NES_API void 		nes_reset(nes_t* nes);
+// Back to power on with the loaded ROM, restoring the snapshot taken at the
+// first nes_create() into the memory already allocated: RAM, VRAM, OAM and
+// CHR-RAM are cleared and every register is as it was.
+NES_API void 		nes_power_cycle(nes_t* nes);
+// The TV system, NES_REGION_*, as the ROM header gives it until set; setting
+// it resets the console.
+NES_API int 		nes_get_region(nes_t* nes);
+NES_API void 		nes_set_region(nes_t* nes, int region);
+
+NES_API void 		nes_step_frame(nes_t* nes);
+// Runs to the next instruction boundary, so nes_get_cpu() shows the state
+// the next instruction starts from.
+NES_API void 		nes_step_instruction(nes_t* nes);
+NES_API void 		nes_get_cpu(nes_t* nes, nes_cpu_t* state);
+// registers and pc only; the cycle and PPU position are not settable
+NES_API void 		nes_set_cpu(nes_t* nes, const nes_cpu_t* state);
+NES_API void 		nes_set_input(nes_t* nes, uint8_t port, uint8_t buttons);
+
+// RGB24, NES_WIDTH x NES_HEIGHT; valid until the next nes_step_frame()
+NES_API const uint8_t* 	nes_get_framebuffer(nes_t* nes);
+// Only the last of every `factor` nes_step_frame() calls composites the
+// picture; the others skip pixel output and keep the framebuffer of the last
+// drawn frame. Sprite 0 hit, sprite overflow, VBlank and the NMI still happen
+// on every frame, so the game runs the same. Defaults to 1, drawing each frame.
+NES_API void 		nes_set_frame_skip(nes_t* nes, int factor);
+// the 2 KiB of work RAM at $0000-$07FF
+NES_API const uint8_t* 	nes_get_ram(nes_t* nes);
+// mono signed 16-bit at NES_SAMPLE_RATE, the audio of the last
+// nes_step_frame(); returns the sample count
+NES_API size_t 		nes_get_audio(nes_t* nes, const int16_t** samples);
+
+// Runs hot PRG-ROM code as translated x86-64 blocks; results are identical to
+// the interpreter. Returns nonzero, leaving the console interpreting, if
+// unsupported on this platform or the code buffer cannot be mapped.
+NES_API int 		nes_set_jit(nes_t* nes, int enabled);
+// counters of the interpreter's PRG-ROM decode cache since the console was created
+NES_API void 		nes_get_decode_stats(nes_t* nes, nes_decode_stats_t* stats);
+// Polling loops waiting for VBlank or the NMI are skipped over in whole
+// passes, with identical results. On by default; turn it off to step every
+// instruction, as tools/conform does.
+NES_API void 		nes_set_idle_skip(nes_t* nes, int enabled);
+NES_API void 		nes_get_idle_stats(nes_t* nes, nes_idle_stats_t* stats);
+// Host-side counters since the console was created. Returns nonzero, with
+// everything zero, unless built with -DNESEMU_STATS.
+NES_API int 		nes_get_stats(nes_t* nes, nes_stats_t* stats);
+// By default an unknown opcode prints a message and exits the process. Turned
+// off, the CPU locks up on it instead, as a 6502 does on its KIL opcodes, and
+// the console runs on; fuzzing wants that. Applies to every console.
+NES_API void 		nes_set_illegal_exit(int enabled);
+
+// Records the last `records` instructions (rounded up to a power of two) into
+// a ring buffer; nes_trace_dump() writes them for tools/tracelog to decode.
+NES_API int 		nes_trace_start(nes_t* nes, size_t records);
+NES_API void 		nes_trace_stop(nes_t* nes);
+NES_API int 		nes_trace_dump(nes_t* nes, const char* filename);
+
+// Counts emulated cycles by guest PC and by routine (JSR target or interrupt
+// vector); nes_profile_report() writes the hottest of each plus the polling
+// loops found. The JIT stays off while profiling.
+NES_API int 		nes_profile_start(nes_t* nes);
+NES_API void 		nes_profile_stop(nes_t* nes);
+NES_API int 		nes_profile_report(nes_t* nes, const char* filename);
+
+// Publishes the framebuffer and work RAM after every frame into the POSIX
+// shared memory segment `name`, for other processes to read with export_read()
+// (see export.h and tools/exportread). Stopping removes the segment.
+NES_API int 		nes_export_start(nes_t* nes, const char* name);
+NES_API void 		nes_export_stop(nes_t* nes);
+
+NES_API size_t 		nes_state_size();
+NES_API size_t 		nes_save_state(nes_t* nes, uint8_t* buffer, size_t size);
+NES_API int 		nes_load_state(nes_t* nes, const uint8_t* buffer, size_t size);
+
+// Batches step many consoles running one ROM a frame at a time, spread over
+// worker threads. inputs holds NES_PORTS bytes per console, console-major;
+// passing NULL keeps the previous input.
+NES_API nes_batch_t* 	nes_batch_create(const char* filename, int count, int threads);
+NES_API void 		nes_batch_destroy(nes_batch_t* batch);
+NES_API nes_t* 		nes_batch_get(nes_batch_t* batch, int index);
+NES_API void 		nes_batch_step_frame(nes_batch_t* batch, const uint8_t* inputs);
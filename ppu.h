@@ -1,4 +1,12 @@
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "console.h"
+
+#define CHANNELS 3
+#define HEIGHT 240 
+#define WIDTH 256
 
 #define PPUCTRL 	0x2000
 #define PPUMASK 	0x2001
@@ -40,14 +48,28 @@ static const uint32_t 	palette[64] = {
 	0xF8D878, 0xD8F878, 0xB8F8B8, 0xB8F8D8, 0x00FCFC, 0xF8D8F8, 0x000000, 0x000000
 };
 
-struct PPU_Registers
+// One row of an 8x8 pattern tile, both planes, normal and mirrored
+// horizontally
+struct Tile_Row
+{
+	uint8_t		lo;
+	uint8_t		hi;
+	uint8_t		lo_flipped;
+	uint8_t		hi_flipped;
+};
+
+// Both pattern tables, decoded lazily and dropped tile by tile on CHR writes.
+// Only sprite evaluation reads it, for the mirrored planes; background
+// fetches are single plane bytes and read CHR directly.
+struct Tile_Cache
 {
-	uint16_t	v : 15; // current vram address
-	uint16_t	t : 15; // temp vram address
-	uint8_t 	x : 3;  // fine x scroll
-	uint8_t 	w : 1;  // first or second write toggle
+	uint8_t			valid[512];
+	struct Tile_Row		rows[512][8];
 };
 
+// PPUMASK's background and sprite enables, as its bits 3 and 4 shifted down
+enum render_mode { Render_Off, Render_Background, Render_Sprites, Render_Both };
+
 struct OAM_Entry
 {
 	uint8_t		y;
@@ -56,7 +78,72 @@ struct OAM_Entry
 	uint8_t		x;
 };
 
-void 	ppu_clock();
+// What the dot loop reads and writes on every dot, on one cache line of its
+// own; the picture and the tile cache it draws with are reached by pointer.
+// v and t are 15 bits wide: nothing but a PPUDATA access can carry past
+// that, and those mask it off.
+struct PPU
+{
+	uint16_t	v; 		// current vram address
+	uint16_t	t; 		// temp vram address
+	uint8_t 	x;  		// fine x scroll
+	uint8_t 	w;  		// first or second write toggle
+
+	uint16_t 	scanline;
+	uint16_t 	cycle;
+
+	uint8_t 	nametable_byte;
+	uint8_t 	attribute_byte;
+	uint8_t 	background_tile_lo;
+	uint8_t 	background_tile_hi;
+
+	uint16_t 	background_shifter_lo;
+	uint16_t 	background_shifter_hi;
+	uint16_t 	attribute_shifter_lo;
+	uint16_t 	attribute_shifter_hi;
+
+	uint8_t		sprite_count;
+	uint8_t 	sprite_shifters_lo[8];
+	uint8_t 	sprite_shifters_hi[8];
+
+	bool		even_frame;
+	bool 		render_sprite_zero;
+
+	// PPUCTRL and PPUMASK as of their last writes, decoded
+	bool		nmi_output;
+	uint8_t		sprite_height;
+	uint16_t 	background_table;
+	uint16_t 	sprite_table;
+	enum render_mode 	render_mode;
+
+	// $2000-$2003 as last written; the CPU's RAM ends at $07FF
+	uint8_t 	control;
+	uint8_t 	mask;
+	uint8_t 	status;
+	uint8_t 	oam_address;
+
+	uint16_t 	frame;
+} __attribute__((aligned(64)));
+
+extern CONSOLE_LOCAL struct PPU ppu;
+extern CONSOLE_LOCAL uint8_t *screen;
+extern CONSOLE_LOCAL bool skip_pixels;
+extern CONSOLE_LOCAL struct Tile_Cache *tile_cache;
+
+// one dot, in the timing of each TV system (see tv_timings)
+void 	ppu_clock_ntsc();
+void 	ppu_clock_pal();
+void 	ppu_clock_dendy();
 void 	ppu_reset();
-void 	debug();
+
+// PPUCTRL and PPUMASK have been written; decodes what the dot loop needs
+void 	ppu_set_control(uint8_t data);
+void 	ppu_set_mask(uint8_t data);
+
+const struct Tile_Row* 	ppu_tile_row(uint16_t address);
+void 			ppu_invalidate_tile(uint16_t address);
+void 			ppu_invalidate_tiles();
+
+size_t 	ppu_save_state(uint8_t* buffer);
+size_t 	ppu_load_state(const uint8_t* buffer);
 
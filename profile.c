@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "cpu.h"
+#include "memory.h"
+#include "disasm.h"
+#include "idle.h"
+
+CONSOLE_LOCAL struct Profile* 	profile;
+
+// Replaces any running profile with an empty one.
+int profile_start()
+{
+	profile_stop();
+
+	profile = calloc(1, sizeof(struct Profile));
+
+	return profile == NULL;
+}
+
+void profile_stop()
+{
+	free(profile);
+	profile = NULL;
+}
+
+// Reads instruction bytes without the side effects cpu_read() has on I/O.
+static inline uint8_t peek(uint16_t address)
+{
+	if (address >= 0x8000)
+		return prg_memory[address & 0x7FFF];
+	if (address <= 0x1FFF)
+		return cpu_memory[address];
+	return 0x00;
+}
+
+static void charge(uint16_t pc, uint16_t cycles)
+{
+	struct Profile* p = profile;
+
+	p->pc_cycles[pc] += cycles;
+	p->total += cycles;
+
+	if (p->depth != 0)
+		p->routine_cycles[p->stack[p->depth - 1].routine] += cycles;
+	else
+		p->top_level += cycles;
+}
+
+static void enter(uint16_t routine)
+{
+	struct Profile* p = profile;
+
+	// too deep to be real calls; forget the outermost
+	if (p->depth == PROFILE_DEPTH)
+	{
+		memmove(&p->stack[0], &p->stack[1], (PROFILE_DEPTH - 1) * sizeof(struct Profile_Frame));
+		p->depth--;
+	}
+
+	p->stack[p->depth].routine = routine;
+	p->stack[p->depth].sp = cpu.sp;
+	p->depth++;
+	p->calls[routine]++;
+}
+
+// Called once the instruction at address has run, with the cycles it took.
+void profile_instruction(uint16_t address, uint16_t cycles)
+{
+	struct Profile* p = profile;
+
+	charge(address, cycles);
+
+	if (peek(address) == 0x20) // JSR, now at its target
+		enter(cpu.pc);
+
+	while (p->depth != 0 && cpu.sp > p->stack[p->depth - 1].sp)
+		p->depth--;
+}
+
+// Called once an NMI or IRQ has pushed its frame and loaded pc.
+void profile_interrupt(uint16_t cycles)
+{
+	enter(cpu.pc);
+	charge(cpu.pc, cycles);
+}
+
+struct Row
+{
+	uint16_t 	address;
+	uint64_t 	cycles;
+};
+
+static int by_cycles(const void* a, const void* b)
+{
+	const struct Row* x = a;
+	const struct Row* y = b;
+
+	return (x->cycles < y->cycles) - (x->cycles > y->cycles);
+}
+
+// The nonzero entries of counts, most cycles first; returns how many
+static size_t rank(const uint64_t* counts, struct Row* rows)
+{
+	size_t count = 0;
+
+	for (uint32_t i = 0; i < 0x10000; i++)
+	{
+		if (counts[i] != 0)
+		{
+			rows[count].address = i;
+			rows[count].cycles = counts[i];
+			count++;
+		}
+	}
+
+	qsort(rows, count, sizeof(struct Row), by_cycles);
+
+	return count;
+}
+
+static double share(uint64_t cycles)
+{
+	return profile->total ? 100.0 * cycles / profile->total : 0;
+}
+
+// Top routines and instructions by emulated cycles, then the polling loops
+// the idle skipper has recognised and the time spent in them.
+int profile_report(const char* filename)
+{
+	struct Profile* p = profile;
+
+	if (p == NULL)
+		return 1;
+
+	struct Row* rows = malloc(0x10000 * sizeof(struct Row));
+	FILE* file = fopen(filename, "w");
+
+	if (rows == NULL || file == NULL)
+	{
+		free(rows);
+		if (file != NULL)
+			fclose(file);
+		return 1;
+	}
+
+	fprintf(file, "%llu cycles profiled\n\n", (unsigned long long)p->total);
+
+	fprintf(file, "routines, by self cycles\n");
+	fprintf(file, "   share        cycles      calls  entry\n");
+
+	size_t count = rank(p->routine_cycles, rows);
+
+	for (size_t i = 0; i < count && i < PROFILE_TOP; i++)
+		fprintf(file, "%7.2f%% %13llu %10u  $%04X\n", share(rows[i].cycles),
+			(unsigned long long)rows[i].cycles, p->calls[rows[i].address], rows[i].address);
+
+	fprintf(file, "%7.2f%% %13llu %10s  top level\n\n", share(p->top_level),
+		(unsigned long long)p->top_level, "");
+
+	fprintf(file, "instructions, by cycles\n");
+	fprintf(file, "   share        cycles  pc     instruction\n");
+
+	count = rank(p->pc_cycles, rows);
+
+	for (size_t i = 0; i < count && i < PROFILE_TOP; i++)
+	{
+		uint16_t address = rows[i].address;
+		uint8_t bytes[3] = { peek(address), peek(address + 1), peek(address + 2) };
+		char text[32];
+
+		disasm(text, sizeof(text), address, bytes);
+
+		fprintf(file, "%7.2f%% %13llu  $%04X  %s\n", share(rows[i].cycles),
+			(unsigned long long)rows[i].cycles, address, text);
+	}
+
+	fprintf(file, "\npolling loops\n");
+	fprintf(file, "   share        cycles  loop         waits on\n");
+
+	for (uint32_t head = 0x8000; head <= 0xFFFF; head++)
+	{
+		uint8_t verdict = idle->verdicts[head & 0x7FFF];
+		uint8_t kind = IDLE_VERDICT(verdict);
+
+		if (kind != Idle_Loop && kind != Idle_Poll_PPU)
+			continue;
+
+		uint64_t cycles = 0;
+		uint32_t end = head + IDLE_SIZE(verdict);
+
+		for (uint32_t address = head; address < end && address <= 0xFFFF; address++)
+			cycles += p->pc_cycles[address];
+
+		if (cycles == 0)
+			continue;
+
+		fprintf(file, "%7.2f%% %13llu  $%04X-$%04X  %s\n", share(cycles), (unsigned long long)cycles,
+			head, end - 1, kind == Idle_Poll_PPU ? "PPUSTATUS" : "an interrupt");
+	}
+
+	free(rows);
+	fclose(file);
+
+	return 0;
+}
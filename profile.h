@@ -0,0 +1,49 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "console.h"
+
+#define PROFILE_DEPTH 	64	// shadow call stack entries
+#define PROFILE_TOP 	20	// rows per table in the report
+
+// A routine being run: the JSR target or interrupt vector it was entered at,
+// and the stack pointer just after its return address was pushed.
+struct Profile_Frame
+{
+	uint16_t 	routine;
+	uint8_t 	sp;
+};
+
+// Emulated cycles by guest PC and by routine. Cycles are charged to the
+// routine on top of a shadow call stack, which JSR and interrupts push and
+// which is unwound whenever the stack pointer climbs back above a frame, so
+// RTS, RTI and code that pulls its return address all leave it right.
+struct Profile
+{
+	uint64_t 		pc_cycles[0x10000];		// self time of each instruction
+	uint64_t 		routine_cycles[0x10000];	// self time of each routine
+	uint32_t 		calls[0x10000];
+	uint64_t 		top_level;			// outside any routine
+	uint64_t 		total;
+
+	struct Profile_Frame 	stack[PROFILE_DEPTH];
+	uint8_t 		depth;
+};
+
+extern CONSOLE_LOCAL struct Profile* 	profile;
+
+// Compiled in unless NESEMU_NO_PROFILE; costs a pointer test per instruction
+// while no profile is running.
+#ifdef NESEMU_NO_PROFILE
+#define PROFILE_INSTRUCTION(pc, cycles) (void)(pc)
+#define PROFILE_INTERRUPT(cycles)
+#else
+#define PROFILE_INSTRUCTION(pc, cycles) if (profile != NULL) profile_instruction(pc, cycles)
+#define PROFILE_INTERRUPT(cycles) 	if (profile != NULL) profile_interrupt(cycles)
+#endif
+
+int 	profile_start();
+void 	profile_stop();
+void 	profile_instruction(uint16_t pc, uint16_t cycles);
+void 	profile_interrupt(uint16_t cycles);
+int 	profile_report(const char* filename);
@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "snapcache.h"
+#include "state.h"
+#include "cartridge.h"
+#include "system.h"
+
+static char 		cache_directory[256];
+static uint64_t 	cache_limit;
+static uint8_t* 	cache_state;	// state_save() sized
+static size_t 		cache_state_size;
+
+static uint64_t 	cache_key;	// of the input so far
+static uint32_t 	cache_frames;
+
+// FNV-1a
+static uint64_t hash(uint64_t key, const void* data, size_t size)
+{
+	const uint8_t* bytes = data;
+
+	for (size_t i = 0; i < size; i++)
+		key = (key ^ bytes[i]) * 0x100000001B3ull;
+
+	return key;
+}
+
+// Everything a snapshot depends on besides the input
+static uint64_t first_key(uint8_t ports)
+{
+	uint64_t key = 0xCBF29CE484222325ull;
+	uint32_t version = STATE_VERSION;
+
+	key = hash(key, &cartridge_hash, sizeof(cartridge_hash));
+	key = hash(key, &version, sizeof(version));
+	key = hash(key, &tv_system, sizeof(tv_system));
+	key = hash(key, &ports, sizeof(ports));
+
+	return key;
+}
+
+static void path(char* buffer, size_t size, uint64_t key)
+{
+	snprintf(buffer, size, "%s/%016llX.nesc", cache_directory, (unsigned long long)key);
+}
+
+// Creates the directory if need be; limit is in bytes
+int snapcache_open(const char* directory, uint64_t limit)
+{
+	snprintf(cache_directory, sizeof(cache_directory), "%s", directory);
+	cache_limit = limit;
+
+	mkdir(directory, 0755);
+
+	struct stat info;
+	if (stat(directory, &info) != 0 || !S_ISDIR(info.st_mode))
+		return 1;
+
+	cache_state_size = state_save(NULL);
+	cache_state = malloc(cache_state_size);
+
+	return cache_state == NULL;
+}
+
+void snapcache_close()
+{
+	free(cache_state);
+	cache_state = NULL;
+}
+
+struct Entry
+{
+	char 			name[32];
+	off_t 			size;
+	struct timespec 	used;
+};
+
+static int by_use(const void* a, const void* b)
+{
+	const struct Entry* x = a;
+	const struct Entry* y = b;
+
+	if (x->used.tv_sec != y->used.tv_sec)
+		return (x->used.tv_sec > y->used.tv_sec) - (x->used.tv_sec < y->used.tv_sec);
+
+	return (x->used.tv_nsec > y->used.tv_nsec) - (x->used.tv_nsec < y->used.tv_nsec);
+}
+
+// Deletes the least recently used snapshots until the rest fit the limit,
+// and temp files left by a writer that died before renaming them
+static void evict()
+{
+	DIR* directory = opendir(cache_directory);
+
+	if (directory == NULL)
+		return;
+
+	struct Entry* entries = NULL;
+	size_t count = 0, capacity = 0;
+	uint64_t total = 0;
+	struct dirent* file;
+	char name[512];
+	time_t now = time(NULL);
+
+	while ((file = readdir(directory)) != NULL)
+	{
+		struct stat info;
+		size_t length = strlen(file->d_name);
+
+		// <key>.nesc, or <key>.nesc.XXXXXX while being written
+		if ((length != 21 && length != 28) || strncmp(file->d_name + 16, ".nesc", 5) != 0)
+			continue;
+
+		snprintf(name, sizeof(name), "%s/%s", cache_directory, file->d_name);
+
+		if (stat(name, &info) != 0)
+			continue;
+
+		if (length == 28)
+		{
+			if (now - info.st_mtime > SNAPCACHE_STALE)
+				remove(name);
+
+			continue;
+		}
+
+		if (count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			struct Entry* grown = realloc(entries, capacity * sizeof(struct Entry));
+
+			if (grown == NULL)
+				break;
+
+			entries = grown;
+		}
+
+		memcpy(entries[count].name, file->d_name, length + 1);
+		entries[count].size = info.st_size;
+		entries[count].used = info.st_mtim;
+		total += info.st_size;
+		count++;
+	}
+
+	closedir(directory);
+
+	qsort(entries, count, sizeof(struct Entry), by_use);
+
+	for (size_t i = 0; i < count && total > cache_limit; i++)
+	{
+		snprintf(name, sizeof(name), "%s/%s", cache_directory, entries[i].name);
+
+		if (remove(name) == 0)
+			total -= entries[i].size;
+	}
+
+	free(entries);
+}
+
+// Loads the snapshot for key if there is one, marking it used
+static int load(uint64_t key, uint32_t frames)
+{
+	char name[512];
+	struct Snapcache_Header header;
+
+	path(name, sizeof(name), key);
+
+	FILE* file = fopen(name, "rb");
+
+	if (file == NULL)
+		return 1;
+
+	int result = fread(&header, sizeof(header), 1, file) != 1 ||
+		     memcmp(header.id, SNAPCACHE_ID, 4) != 0 || header.key != key || header.frames != frames ||
+		     fread(cache_state, cache_state_size, 1, file) != 1 || state_load(cache_state) == 0;
+
+	fclose(file);
+
+	if (result == 0)
+		utime(name, NULL);
+
+	return result;
+}
+
+static void store(uint64_t key, uint32_t frames)
+{
+	char name[512], temporary[520];
+	struct Snapcache_Header header;
+
+	path(name, sizeof(name), key);
+
+	// already there: it has just been used again
+	if (utime(name, NULL) == 0)
+		return;
+
+	memcpy(header.id, SNAPCACHE_ID, 4);
+	header.frames = frames;
+	header.key = key;
+
+	state_save(cache_state);
+
+	// written aside and renamed, so a reader never sees half a file; the
+	// name is unique, so runs storing the same key don't share one
+	snprintf(temporary, sizeof(temporary), "%s.XXXXXX", name);
+
+	int fd = mkstemp(temporary);
+
+	if (fd < 0)
+		return;
+
+	// mkstemp() makes it private; snapshots are as readable as the directory
+	fchmod(fd, 0644);
+
+	FILE* file = fdopen(fd, "wb");
+
+	if (file == NULL)
+	{
+		close(fd);
+		remove(temporary);
+		return;
+	}
+
+	int failed = fwrite(&header, sizeof(header), 1, file) != 1 ||
+		     fwrite(cache_state, cache_state_size, 1, file) != 1;
+
+	if (fclose(file) != 0 || failed || rename(temporary, name) != 0)
+	{
+		remove(temporary);
+		return;
+	}
+
+	evict();
+}
+
+// Called after power on with the whole movie's input: resumes from the
+// longest prefix of it that has a snapshot, returning the frames skipped.
+// With frames 0 it only starts hashing, as for a movie being recorded.
+uint32_t snapcache_resume(const uint8_t* inputs, uint32_t frames, uint8_t ports)
+{
+	uint32_t checkpoints = frames / SNAPCACHE_INTERVAL;
+	uint64_t* keys = malloc((checkpoints + 1) * sizeof(uint64_t));
+
+	cache_key = first_key(ports);
+	cache_frames = 0;
+
+	if (keys == NULL)
+		return 0;
+
+	keys[0] = cache_key;
+
+	for (uint32_t i = 1; i <= checkpoints; i++)
+		keys[i] = hash(keys[i - 1], &inputs[(size_t)(i - 1) * SNAPCACHE_INTERVAL * ports],
+			       (size_t)SNAPCACHE_INTERVAL * ports);
+
+	for (uint32_t i = checkpoints; i > 0; i--)
+	{
+		if (load(keys[i], i * SNAPCACHE_INTERVAL) == 0)
+		{
+			cache_key = keys[i];
+			cache_frames = i * SNAPCACHE_INTERVAL;
+			break;
+		}
+	}
+
+	free(keys);
+
+	return cache_frames;
+}
+
+// Called after each frame with the input it was run with; every
+// SNAPCACHE_INTERVAL frames the console is stored if it isn't already.
+void snapcache_frame(const uint8_t* input, uint8_t ports)
+{
+	cache_key = hash(cache_key, input, ports);
+	cache_frames++;
+
+	if (cache_frames % SNAPCACHE_INTERVAL == 0)
+		store(cache_key, cache_frames);
+}
@@ -0,0 +1,24 @@
+#include <stdint.h>
+#include <stddef.h>
+
+// An on-disk cache of snapshots taken while a movie plays or records, named
+// by a hash of the ROM, the TV system and every input byte up to them. A
+// later run whose movie starts with the same input resumes from the longest
+// such prefix instead of booting. Past the size limit the least recently
+// used snapshots are deleted; a file's modification time is its last use.
+
+#define SNAPCACHE_ID 		"NESC"
+#define SNAPCACHE_INTERVAL 	300	// frames between snapshots
+#define SNAPCACHE_STALE 	600	// seconds before an unrenamed temp file is litter
+
+struct Snapcache_Header
+{
+	char 		id[4];
+	uint32_t 	frames;		// emulated before the snapshot
+	uint64_t 	key;
+};
+
+int 		snapcache_open(const char* directory, uint64_t limit);
+void 		snapcache_close();
+uint32_t 	snapcache_resume(const uint8_t* inputs, uint32_t frames, uint8_t ports);
+void 		snapcache_frame(const uint8_t* input, uint8_t ports);
@@ -0,0 +1,87 @@
+#include "state.h"
+#include "system.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "memory.h"
+#include "cartridge.h"
+#include "controller.h"
+#include "apu.h"
+#include "idle.h"
+
+// Everything but the memory blocks: small enough to swap on every switch
+// between consoles sharing the same globals.
+size_t state_save_context(uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	offset += system_save_state(buffer ? buffer + offset : NULL);
+	offset += cpu_save_state(buffer ? buffer + offset : NULL);
+	offset += ppu_save_state(buffer ? buffer + offset : NULL);
+	offset += memory_save_state(buffer ? buffer + offset : NULL);
+	offset += cartridge_save_state(buffer ? buffer + offset : NULL);
+	offset += controller_save_state(buffer ? buffer + offset : NULL);
+	offset += apu_save_state(buffer ? buffer + offset : NULL);
+
+	return offset;
+}
+
+size_t state_load_context(const uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	offset += system_load_state(buffer + offset);
+	offset += cpu_load_state(buffer + offset);
+	offset += ppu_load_state(buffer + offset);
+	offset += memory_load_state(buffer + offset);
+	offset += cartridge_load_state(buffer + offset);
+	offset += controller_load_state(buffer + offset);
+	offset += apu_load_state(buffer + offset);
+
+	return offset;
+}
+
+size_t state_save(uint8_t* buffer)
+{
+	size_t offset = 0;
+	uint32_t version = STATE_VERSION;
+
+	SAVE_STATE(buffer, offset, version);
+	SAVE_STATE(buffer, offset, cartridge_hash);
+
+	offset += state_save_context(buffer ? buffer + offset : NULL);
+
+	SAVE_BLOCK(buffer, offset, cpu_memory, CPU_MEMORY_SIZE);
+	SAVE_BLOCK(buffer, offset, ppu_memory, PPU_MEMORY_SIZE);
+	SAVE_BLOCK(buffer, offset, primary_oam, OAM_SIZE);
+	SAVE_BLOCK(buffer, offset, secondary_oam, OAM_SIZE);
+
+	return offset;
+}
+
+// Returns the number of bytes consumed, or 0 if the snapshot was written by
+// an incompatible build or for another ROM.
+size_t state_load(const uint8_t* buffer)
+{
+	size_t offset = 0;
+	uint32_t version;
+	uint64_t hash;
+
+	LOAD_STATE(buffer, offset, version);
+	LOAD_STATE(buffer, offset, hash);
+
+	// PRG is not part of the snapshot, so it only fits the ROM it came from
+	if (version != STATE_VERSION || hash != cartridge_hash)
+		return 0;
+
+	offset += state_load_context(buffer + offset);
+
+	LOAD_BLOCK(buffer, offset, cpu_memory, CPU_MEMORY_SIZE);
+	LOAD_BLOCK(buffer, offset, ppu_memory, PPU_MEMORY_SIZE);
+	LOAD_BLOCK(buffer, offset, primary_oam, OAM_SIZE);
+	LOAD_BLOCK(buffer, offset, secondary_oam, OAM_SIZE);
+
+	ppu_invalidate_tiles();
+	idle_reset();
+
+	return offset;
+}
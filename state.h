@@ -0,0 +1,25 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// Each module serialises its own globals through these. Passing a NULL
+// buffer to a save function only measures how many bytes it would write.
+#define SAVE_STATE(buffer, offset, var) \
+	do { if (buffer) memcpy((buffer) + (offset), &(var), sizeof(var)); (offset) += sizeof(var); } while (0)
+
+#define LOAD_STATE(buffer, offset, var) \
+	do { memcpy(&(var), (buffer) + (offset), sizeof(var)); (offset) += sizeof(var); } while (0)
+
+#define SAVE_BLOCK(buffer, offset, block, size) \
+	do { if (buffer) memcpy((buffer) + (offset), (block), (size)); (offset) += (size); } while (0)
+
+#define LOAD_BLOCK(buffer, offset, block, size) \
+	do { memcpy((block), (buffer) + (offset), (size)); (offset) += (size); } while (0)
+
+#define STATE_VERSION 8
+
+size_t 	state_save(uint8_t* buffer);
+size_t 	state_load(const uint8_t* buffer);
+
+size_t 	state_save_context(uint8_t* buffer);
+size_t 	state_load_context(const uint8_t* buffer);
@@ -0,0 +1,98 @@
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+CONSOLE_LOCAL struct Stats* 	host_stats;
+
+void stats_reset()
+{
+	memset(host_stats, 0, sizeof(struct Stats));
+}
+
+static uint64_t nanoseconds()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// The TSC where there is one, nanoseconds elsewhere
+uint64_t stats_ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return nanoseconds();
+#endif
+}
+
+// Measured once over 10 ms; shared by every console
+double stats_ticks_per_second()
+{
+	static double rate;
+
+	if (rate == 0)
+	{
+		struct timespec pause = { 0, 10000000 };
+
+		uint64_t start = nanoseconds();
+		uint64_t ticks = stats_ticks();
+
+		nanosleep(&pause, NULL);
+
+		rate = (stats_ticks() - ticks) * 1e9 / (nanoseconds() - start);
+	}
+
+	return rate;
+}
+
+static double milliseconds(enum stat_timer timer)
+{
+	if (host_stats->timed[timer] == 0)
+		return 0;
+
+	return host_stats->ticks[timer] / stats_ticks_per_second() * 1000 / host_stats->timed[timer];
+}
+
+// One line of totals since power on, plus the average of each timer
+void stats_dump(FILE* file)
+{
+	struct Stats* s = host_stats;
+
+	fprintf(file, "interpreted %llu predecoded %llu jit_blocks %llu idle_stalls %llu",
+		(unsigned long long)s->interpreted, (unsigned long long)s->predecoded,
+		(unsigned long long)s->jit_blocks, (unsigned long long)s->idle_stalls);
+
+	fprintf(file, " cpu_reads %llu/%llu/%llu/%llu cpu_writes %llu/%llu/%llu/%llu",
+		(unsigned long long)s->cpu_reads[Region_RAM], (unsigned long long)s->cpu_reads[Region_PPU],
+		(unsigned long long)s->cpu_reads[Region_IO], (unsigned long long)s->cpu_reads[Region_PRG],
+		(unsigned long long)s->cpu_writes[Region_RAM], (unsigned long long)s->cpu_writes[Region_PPU],
+		(unsigned long long)s->cpu_writes[Region_IO], (unsigned long long)s->cpu_writes[Region_PRG]);
+
+	fprintf(file, " ppu_reads %llu/%llu/%llu",
+		(unsigned long long)s->ppu_reads[Region_Pattern], (unsigned long long)s->ppu_reads[Region_Nametable],
+		(unsigned long long)s->ppu_reads[Region_Palette]);
+
+	fprintf(file, " ppu_register_reads");
+	for (int i = 0; i < 8; i++)
+		fprintf(file, "%c%llu", i ? '/' : ' ', (unsigned long long)s->ppu_register_reads[i]);
+
+	fprintf(file, " ppu_register_writes");
+	for (int i = 0; i < 8; i++)
+		fprintf(file, "%c%llu", i ? '/' : ' ', (unsigned long long)s->ppu_register_writes[i]);
+
+	fprintf(file, " sprite_evaluations %llu sprite_overflows %llu frames %llu frame_ms %.3f present_ms %.3f",
+		(unsigned long long)s->sprite_evaluations, (unsigned long long)s->sprite_overflows,
+		(unsigned long long)s->timed[Timer_Frame], milliseconds(Timer_Frame), milliseconds(Timer_Present));
+
+	fprintf(file, " apu_share %.1f%%\n",
+		s->ticks[Timer_Frame] ? 100.0 * s->ticks[Timer_APU] / s->ticks[Timer_Frame] : 0.0);
+
+	fflush(file);
+}
@@ -0,0 +1,81 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "console.h"
+
+// Host-side counters and timers for finding where the time goes in a
+// production build. Compiled in with NESEMU_STATS; otherwise the STAT_*
+// macros are empty and the counters stay zero.
+
+// Regions of the CPU address space, by address >> 13
+enum stat_region
+{
+	Region_RAM, 		// $0000-$1FFF
+	Region_PPU, 		// $2000-$3FFF
+	Region_IO, 		// $4000-$7FFF: APU, controllers and cartridge space
+	Region_PRG, 		// $8000-$FFFF
+	REGIONS
+};
+
+// ...and of the PPU's
+enum stat_ppu_region
+{
+	Region_Pattern, 	// $0000-$1FFF
+	Region_Nametable, 	// $2000-$3EFF
+	Region_Palette, 	// $3F00-$3FFF
+	PPU_REGIONS
+};
+
+enum stat_timer
+{
+	Timer_Frame, 		// system_step_frame()
+	Timer_Present, 		// showing a frame, for frontends that time it
+	Timer_APU, 		// synthesis, within Timer_Frame
+	TIMERS
+};
+
+struct Stats
+{
+	uint64_t 	interpreted;		// instructions through the opcode switch
+	uint64_t 	predecoded;		// ...and through the decode cache
+	uint64_t 	jit_blocks;		// blocks run, of any number of instructions
+	uint64_t 	idle_stalls;
+
+	uint64_t 	cpu_reads[REGIONS];
+	uint64_t 	cpu_writes[REGIONS];
+	uint64_t 	ppu_reads[PPU_REGIONS];
+	uint64_t 	ppu_register_reads[8];	// $2000-$2007, mirrors folded
+	uint64_t 	ppu_register_writes[8];
+
+	uint64_t 	sprite_evaluations;	// scanlines
+	uint64_t 	sprite_overflows;
+
+	uint64_t 	ticks[TIMERS];		// see stats_ticks()
+	uint64_t 	timed[TIMERS];		// intervals measured
+};
+
+extern CONSOLE_LOCAL struct Stats* 	host_stats;
+
+static const uint8_t 	lut_stat_regions[8] = {
+	Region_RAM, Region_PPU, Region_IO, Region_IO, Region_PRG, Region_PRG, Region_PRG, Region_PRG
+};
+
+#define STAT_REGION(address) 	lut_stat_regions[(uint16_t)(address) >> 13]
+#define STAT_PPU_REGION(address) \
+	((address) <= 0x1FFF ? Region_Pattern : (address) <= 0x3EFF ? Region_Nametable : Region_Palette)
+
+#ifdef NESEMU_STATS
+#define STAT_COUNT(counter) 			(host_stats->counter++)
+#define STAT_TIMER_START(name) 			uint64_t name = stats_ticks()
+#define STAT_TIMER_STOP(name, timer) \
+	do { host_stats->ticks[timer] += stats_ticks() - (name); host_stats->timed[timer]++; } while (0)
+#else
+#define STAT_COUNT(counter) 			((void)0)
+#define STAT_TIMER_START(name) 			((void)0)
+#define STAT_TIMER_STOP(name, timer) 		((void)0)
+#endif
+
+void 		stats_reset();
+uint64_t 	stats_ticks();
+double 		stats_ticks_per_second();
+void 		stats_dump(FILE* file);
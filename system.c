@@ -1,33 +1,216 @@
 #include "system.h"
 #include "cpu.h"
 #include "ppu.h"
+#include "controller.h"
+#include "apu.h"
+#include "state.h"
+#include "idle.h"
+#include "stats.h"
 
-bool trigger_nmi;
+#define DOT(line, dot) 	((line) * 341 + (dot))
 
-void clock()
+#define TV_TIMING(system, name, vblank, prerender, skip, dots, rate) \
+	[system] = { .vblank_line = vblank, .prerender_line = prerender, .odd_frame_skip = skip, \
+		     .dots_per_cycle = dots, .cpu_rate = rate },
+
+const struct TV_Timing tv_timings[3] = { TV_SYSTEMS(TV_TIMING) };
+
+CONSOLE_LOCAL bool trigger_nmi;
+CONSOLE_LOCAL bool frame_complete;
+CONSOLE_LOCAL uint64_t cpu_cycle_count;
+CONSOLE_LOCAL bool fetch_pending;
+CONSOLE_LOCAL enum tv_system tv_system;
+CONSOLE_LOCAL uint8_t pal_phase;	// cycles into PAL's 16 dots per 5 cycles
+
+// Runs f specialised for the current TV system, so the choice is made once
+// per call rather than once per dot.
+#define FOR_TV_SYSTEM(f) \
+	switch (tv_system) \
+	{ \
+		case NTSC: 	f(NTSC); break; \
+		case PAL: 	f(PAL); break; \
+		case Dendy: 	f(Dendy); break; \
+	}
+
+// Everything in a cycle that happens before the CPU gets to run.
+static inline __attribute__((always_inline)) void system_clock_devices(const enum tv_system tv)
 {
-	for (uint8_t i = 3; i--;)
-		ppu_clock();
+	switch (tv)
+	{
+		case NTSC:
+			ppu_clock_ntsc(); ppu_clock_ntsc(); ppu_clock_ntsc();
+			break;
+		case PAL:
+			ppu_clock_pal(); ppu_clock_pal(); ppu_clock_pal();
+
+			if (++pal_phase == 5)
+			{
+				pal_phase = 0;
+				ppu_clock_pal();
+			}
+			break;
+		case Dendy:
+			ppu_clock_dendy(); ppu_clock_dendy(); ppu_clock_dendy();
+			break;
+	}
 
 	if (trigger_nmi)
 	{
 		nmi();
 		trigger_nmi = false;
 	}
+	else if (apu_irq())
+		irq();
+}
+
+static inline __attribute__((always_inline)) void clock_cycle(const enum tv_system tv)
+{
+	// system_step_instruction() stopped halfway through this cycle
+	if (fetch_pending)
+		fetch_pending = false;
+	else
+		system_clock_devices(tv);
 	
 	cpu_clock();
+	cpu_cycle_count++;
+}
+
+void system_clock()
+{
+	FOR_TV_SYSTEM(clock_cycle)
 }
 
-void reset()
+static inline __attribute__((always_inline)) void run_frame(const enum tv_system tv)
 {
+	while (!frame_complete)
+		clock_cycle(tv);
+}
+
+// Runs the rest of the current frame and hands the audio it produced to
+// apu_buffer->samples.
+void system_step_frame()
+{
+	STAT_TIMER_START(start);
+
+	FOR_TV_SYSTEM(run_frame)
+
+	frame_complete = false;
+
+	apu_end_frame();
+
+	STAT_TIMER_STOP(start, Timer_Frame);
+}
+
+static inline __attribute__((always_inline)) void run_instruction(const enum tv_system tv)
+{
+	bool run_one = fetch_pending;
+
+	for (;;)
+	{
+		if (fetch_pending)
+			fetch_pending = false;
+		else
+			system_clock_devices(tv);
+
+		if (cpu.cycles == 0)
+		{
+			if (!run_one)
+			{
+				fetch_pending = true;
+				return;
+			}
+
+			run_one = false;
+		}
+
+		cpu_clock();
+		cpu_cycle_count++;
+	}
+}
+
+// Runs until the CPU is about to fetch an opcode, with any interrupt that
+// comes first already taken: the state a nestest-style log shows on each line.
+// Stopped there already, the pending instruction runs first.
+void system_step_instruction()
+{
+	FOR_TV_SYSTEM(run_instruction)
+}
+
+// CPU cycles that can pass before the NMI, the end of the frame or an APU
+// IRQ, for work done ahead of time (see jit.c and idle.c) that none of them
+// may land in the middle of. scanline/ppu_cycle is the next dot to be clocked.
+uint32_t system_event_horizon()
+{
+	const struct TV_Timing* timing = &tv_timings[tv_system];
+
+	uint32_t vblank = DOT(timing->vblank_line, 1);
+	uint32_t frame_end = DOT(timing->prerender_line, timing->odd_frame_skip ? 339 : 340);	// the earliest
+	uint32_t dot = DOT(ppu.scanline, ppu.cycle);
+	uint32_t cycles;
+
+	if (dot <= vblank)
+		cycles = (vblank - dot) / timing->dots_per_cycle;
+	else if (dot <= frame_end)
+		cycles = (frame_end - dot) / timing->dots_per_cycle;
+	else
+		return 0;
+
+	if (apu.next_event <= cpu_cycle_count)
+		return 0;
+
+	if (apu.next_event - cpu_cycle_count <= cycles)
+		cycles = apu.next_event - cpu_cycle_count - 1;
+
+	return cycles;
+}
+
+void system_reset()
+{
+	trigger_nmi = false;
+	frame_complete = false;
+	fetch_pending = false;
+	pal_phase = 0;
+
+	idle_reset();
+	reset_controller();
+	controller_strobe = 0x00;
+
 	cpu_reset();
 	ppu_reset();
+	apu_reset();
 }
 
-void debug()
+void system_debug()
 {
 	//printf("f:%d		%04X  %02X	A:%02X X:%02X Y:%02X P:%02X  SP:%02X\n", 
 	//	frame, pc, opcode, registers.a, registers.x, registers.y, registers.p, registers.sp);
 	//printf("%04X  %02X %d\n", pc, opcode, counter);
 }
 
+size_t system_save_state(uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	SAVE_STATE(buffer, offset, trigger_nmi);
+	SAVE_STATE(buffer, offset, frame_complete);
+	SAVE_STATE(buffer, offset, cpu_cycle_count);
+	SAVE_STATE(buffer, offset, fetch_pending);
+	SAVE_STATE(buffer, offset, tv_system);
+	SAVE_STATE(buffer, offset, pal_phase);
+
+	return offset;
+}
+
+size_t system_load_state(const uint8_t* buffer)
+{
+	size_t offset = 0;
+
+	LOAD_STATE(buffer, offset, trigger_nmi);
+	LOAD_STATE(buffer, offset, frame_complete);
+	LOAD_STATE(buffer, offset, cpu_cycle_count);
+	LOAD_STATE(buffer, offset, fetch_pending);
+	LOAD_STATE(buffer, offset, tv_system);
+	LOAD_STATE(buffer, offset, pal_phase);
+
+	return offset;
+}
@@ -1,9 +1,45 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
-void clock();
-void reset();
-void debug();
+#include "console.h"
 
-extern bool	trigger_nmi;
+// What differs between the TV systems, apart from the APU's tables, for
+// X(system, name, vblank_line, prerender_line, odd_frame_skip,
+// dots_per_cycle, cpu_rate). The PPU takes its per-system dot functions
+// from here too, with the lines folded in as constants.
+#define TV_SYSTEMS(X) \
+	X(NTSC, 	ntsc, 	241, 261, true, 	3, 1789773) \
+	X(PAL, 		pal, 	241, 311, false, 	4, 1662607) \
+	X(Dendy, 	dendy, 	291, 311, false, 	3, 1773448)
+
+#define TV_SYSTEM_ENUM(system, name, vblank, prerender, skip, dots, rate) 	system,
+
+enum tv_system { TV_SYSTEMS(TV_SYSTEM_ENUM) };
+
+struct TV_Timing
+{
+	uint16_t 	vblank_line;		// VBlank starts at its dot 1
+	uint16_t 	prerender_line;		// the last of the frame
+	bool 		odd_frame_skip;		// rendering odd frames a dot short
+	uint8_t 	dots_per_cycle;		// at most; PAL averages 3.2
+	uint32_t 	cpu_rate;		// Hz
+};
+
+extern const struct TV_Timing 	tv_timings[3];
+
+void system_clock();
+void system_reset();
+void system_step_frame();
+void system_step_instruction();
+void system_debug();
+uint32_t system_event_horizon();
+
+size_t system_save_state(uint8_t* buffer);
+size_t system_load_state(const uint8_t* buffer);
+
+extern CONSOLE_LOCAL bool	trigger_nmi;
+extern CONSOLE_LOCAL bool	frame_complete;
+extern CONSOLE_LOCAL uint64_t	cpu_cycle_count;
+extern CONSOLE_LOCAL enum tv_system	tv_system;
 
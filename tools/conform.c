@@ -0,0 +1,322 @@
+// Differential conformance runner. Steps a ROM one instruction at a time and
+// compares the CPU against a reference log in nestest.log format, streamed
+// from disk, stopping at the first divergence.
+//
+//   conform [--no-cycles] <rom> <log>
+//   conform [--no-cycles] [-j workers] <directory>
+//
+// A directory pairs every foo.nes with foo.log and runs them in forked
+// workers, one ROM each, so a ROM that brings the emulator down only fails
+// itself. The first log line seeds pc and registers (nestest's automation
+// mode starts at $C000); cycles are compared relative to it. B and the
+// unused bit of P are ignored.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "nes.h"
+
+#define CONTEXT 	8
+#define LINE_SIZE 	256
+#define P_MASK 		0xCF
+
+struct Expected
+{
+	uint16_t	pc;
+	uint8_t		a;
+	uint8_t		x;
+	uint8_t		y;
+	uint8_t		p;
+	uint8_t		sp;
+	bool		has_cycle;
+	uint64_t	cycle;
+};
+
+static bool compare_cycles = true;
+
+// what the current ROM has matched so far, for the report
+static FILE* 		report;
+static const char* 	report_rom;
+static char 		context[CONTEXT][LINE_SIZE];
+static uint64_t 	matched;
+static bool 		finished;
+
+static bool parse_field(const char* line, const char* name, unsigned long long* value, int base)
+{
+	const char* field = strstr(line, name);
+
+	if (field == NULL)
+		return false;
+
+	*value = strtoull(field + strlen(name), NULL, base);
+	return true;
+}
+
+static bool parse_line(const char* line, struct Expected* e)
+{
+	unsigned long long a, x, y, p, sp, cycle;
+
+	if (strlen(line) < 4 || !parse_field(line, "A:", &a, 16) || !parse_field(line, "X:", &x, 16) ||
+		!parse_field(line, "Y:", &y, 16) || !parse_field(line, " P:", &p, 16) || !parse_field(line, "SP:", &sp, 16))
+		return false;
+
+	e->pc = strtoul(line, NULL, 16);
+	e->a = a;
+	e->x = x;
+	e->y = y;
+	e->p = p;
+	e->sp = sp;
+	e->has_cycle = parse_field(line, "CYC:", &cycle, 10);
+	e->cycle = e->has_cycle ? cycle : 0;
+
+	return true;
+}
+
+static void print_context()
+{
+	uint64_t shown = matched < CONTEXT ? matched : CONTEXT;
+
+	for (uint64_t i = matched - shown; i < matched; i++)
+		fprintf(report, "    %s", context[i % CONTEXT]);
+}
+
+static void print_cpu(const char* label, uint16_t pc, uint8_t a, uint8_t x, uint8_t y, uint8_t p, uint8_t sp,
+		      bool has_cycle, uint64_t cycle)
+{
+	fprintf(report, "  %s %04X  A:%02X X:%02X Y:%02X P:%02X SP:%02X", label, pc, a, x, y, p, sp);
+
+	if (has_cycle)
+		fprintf(report, " CYC:%llu", (unsigned long long)cycle);
+
+	fprintf(report, "\n");
+}
+
+// the emulator may exit() on an opcode it does not know; still say where
+static void report_crash()
+{
+	if (finished)
+		return;
+
+	fprintf(report, "FAIL %s: emulator stopped after %llu instructions\n", report_rom, (unsigned long long)matched);
+	print_context();
+	fflush(report);
+}
+
+// Returns 0 when the whole log matched.
+static int run(const char* rom, const char* log)
+{
+	report_rom = rom;
+	matched = 0;
+	finished = false;
+
+	FILE* stream = fopen(log, "r");
+	nes_t* nes = nes_create();
+
+	if (stream == NULL || nes == NULL || nes_load_rom(nes, rom) != 0)
+	{
+		fprintf(report, "FAIL %s: cannot load ROM or %s\n", rom, log);
+		finished = true;
+
+		if (stream != NULL)
+			fclose(stream);
+
+		nes_destroy(nes);
+		return 1;
+	}
+
+	// the log has a line for every pass of a polling loop
+	nes_set_idle_skip(nes, 0);
+
+	char line[LINE_SIZE];
+	struct Expected expected;
+	nes_cpu_t cpu;
+	uint64_t cycle_base = 0, expected_base = 0;
+	bool based = false;
+
+	// finish the reset sequence, then start from the log's first state
+	nes_step_instruction(nes);
+
+	while (fgets(line, sizeof(line), stream) != NULL)
+	{
+		if (!parse_line(line, &expected))
+			continue;
+
+		if (matched == 0)
+		{
+			cpu = (nes_cpu_t){ .pc = expected.pc, .a = expected.a, .x = expected.x,
+				.y = expected.y, .p = expected.p, .sp = expected.sp };
+			nes_set_cpu(nes, &cpu);
+		}
+
+		nes_get_cpu(nes, &cpu);
+
+		// cycles count from the first line that has them
+		if (expected.has_cycle && !based)
+		{
+			cycle_base = cpu.cycle;
+			expected_base = expected.cycle;
+			based = true;
+		}
+
+		bool cycle_ok = !compare_cycles || !expected.has_cycle ||
+			cpu.cycle - cycle_base == expected.cycle - expected_base;
+
+		if (cpu.pc != expected.pc || cpu.a != expected.a || cpu.x != expected.x || cpu.y != expected.y ||
+			(cpu.p & P_MASK) != (expected.p & P_MASK) || cpu.sp != expected.sp || !cycle_ok)
+		{
+			fprintf(report, "FAIL %s: diverged at instruction %llu (%s line %llu)\n",
+				rom, (unsigned long long)matched + 1, log, (unsigned long long)matched + 1);
+			print_context();
+			fprintf(report, "  > %s", line);
+			print_cpu("expected", expected.pc, expected.a, expected.x, expected.y, expected.p, expected.sp,
+				  expected.has_cycle, expected.cycle - expected_base);
+			print_cpu("got     ", cpu.pc, cpu.a, cpu.x, cpu.y, cpu.p, cpu.sp,
+				  expected.has_cycle, cpu.cycle - cycle_base);
+
+			finished = true;
+			fclose(stream);
+			nes_destroy(nes);
+			return 1;
+		}
+
+		strcpy(context[matched % CONTEXT], line);
+		matched++;
+
+		nes_step_instruction(nes);
+	}
+
+	fprintf(report, "PASS %s: %llu instructions\n", rom, (unsigned long long)matched);
+
+	finished = true;
+	fclose(stream);
+	nes_destroy(nes);
+	return 0;
+}
+
+static char* 	report_buffer;
+static size_t 	report_size;
+
+// Hands a worker's buffered report to stdout in one piece, whichever way the
+// worker ends.
+static void flush_report()
+{
+	report_crash();
+	fclose(report);
+	fwrite(report_buffer, 1, report_size, stdout);
+	fflush(stdout);
+}
+
+static pid_t spawn(const char* rom, const char* log)
+{
+	fflush(stdout);
+
+	pid_t pid = fork();
+
+	if (pid != 0)
+		return pid;
+
+	report = open_memstream(&report_buffer, &report_size);
+	atexit(flush_report);
+
+	exit(run(rom, log));
+}
+
+static bool has_suffix(const char* name, const char* suffix)
+{
+	size_t length = strlen(name), suffix_length = strlen(suffix);
+	return length > suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+static int run_directory(const char* path, int workers)
+{
+	DIR* directory = opendir(path);
+
+	if (directory == NULL)
+	{
+		printf("Cannot open %s\n", path);
+		return 1;
+	}
+
+	int running = 0, passed = 0, failed = 0;
+	struct dirent* entry;
+
+	while ((entry = readdir(directory)) != NULL)
+	{
+		if (!has_suffix(entry->d_name, ".nes"))
+			continue;
+
+		char rom[4096], log[4096];
+		snprintf(rom, sizeof(rom), "%s/%s", path, entry->d_name);
+		snprintf(log, sizeof(log), "%.*s.log", (int)strlen(rom) - 4, rom);
+
+		if (access(log, R_OK) != 0)
+			continue;
+
+		if (running == workers)
+		{
+			int status;
+			wait(&status);
+			running--;
+			(WIFEXITED(status) && WEXITSTATUS(status) == 0) ? passed++ : failed++;
+		}
+
+		if (spawn(rom, log) > 0)
+			running++;
+		else
+			failed++;
+	}
+
+	closedir(directory);
+
+	for (int status; running > 0; running--)
+	{
+		wait(&status);
+		(WIFEXITED(status) && WEXITSTATUS(status) == 0) ? passed++ : failed++;
+	}
+
+	printf("%d passed, %d failed\n", passed, failed);
+
+	return failed != 0;
+}
+
+int main(int argc, char* argv[])
+{
+	int workers = sysconf(_SC_NPROCESSORS_ONLN);
+	const char* paths[2];
+	int path_count = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--no-cycles") == 0)
+			compare_cycles = false;
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+			workers = atoi(argv[++i]);
+		else if (path_count < 2)
+			paths[path_count++] = argv[i];
+		else
+			path_count = 3;
+	}
+
+	if (workers < 1)
+		workers = 1;
+
+	if (path_count == 1)
+		return run_directory(paths[0], workers);
+
+	if (path_count != 2)
+	{
+		printf("usage: conform [--no-cycles] <rom> <log>\n");
+		printf("       conform [--no-cycles] [-j workers] <directory>\n");
+		return 1;
+	}
+
+	report = stdout;
+	atexit(report_crash);
+
+	return run(paths[0], paths[1]);
+}
@@ -0,0 +1,75 @@
+// Follows the frames a console publishes with --export / nes_export_start(),
+// printing the frame number and checksums of the picture and work RAM for
+// each new one seen. The last is written as a PPM if a file is given.
+//
+// usage: exportread <shm name> [frames] [ppm]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "export.h"
+#include "bench.h"
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: exportread <shm name> [frames] [ppm]\n");
+		return 1;
+	}
+
+	struct Export_Header* header = export_open(argv[1]);
+
+	if (header == NULL)
+	{
+		printf("No export called %s\n", argv[1]);
+		return 1;
+	}
+
+	int frames = argc > 2 ? atoi(argv[2]) : 1;
+	size_t screen_size = header->width * header->height * 3;
+	uint8_t* screen = malloc(screen_size);
+	uint8_t* ram = malloc(header->ram_size);
+	uint64_t last = 0;
+
+	struct timespec pause = { 0, 1000000 };
+
+	for (int seen = 0; seen < frames; )
+	{
+		uint64_t frame = export_read(header, screen, ram);
+
+		if (frame == last)
+		{
+			nanosleep(&pause, NULL);
+			continue;
+		}
+
+		printf("frame %llu  ram %08X  framebuffer %08X\n", (unsigned long long)frame,
+		       checksum(ram, header->ram_size), checksum(screen, screen_size));
+
+		last = frame;
+		seen++;
+	}
+
+	if (argc > 3)
+	{
+		FILE* ppm = fopen(argv[3], "wb");
+
+		if (ppm == NULL)
+		{
+			printf("Cannot create %s\n", argv[3]);
+			return 1;
+		}
+
+		fprintf(ppm, "P6\n%u %u\n255\n", header->width, header->height);
+		fwrite(screen, 1, screen_size, ppm);
+		fclose(ppm);
+	}
+
+	free(screen);
+	free(ram);
+	export_close(header);
+
+	return 0;
+}
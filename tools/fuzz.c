@@ -0,0 +1,289 @@
+// Fuzz target for the core, in libFuzzer's LLVMFuzzerTestOneInput() form.
+// The first byte of each input says what the rest is:
+//
+//   bit 0 clear	an iNES image, handed to the ROM loader as is
+//   bit 0 set		one byte of input per port per frame, then PRG code that
+//			is mapped at $8000 with every vector pointing at it
+//   bits 1-3		frames to run, less one
+//   bit 4		JIT on
+//
+// One console is made on the first call and power cycled from its snapshot
+// before every run, so an iteration allocates nothing. Unknown opcodes lock
+// the CPU up rather than exiting.
+//
+// Built with -DFUZZ_MAIN there is a driver of our own instead of libFuzzer's:
+//
+//   fuzz [-n iterations] [--fresh] [--check] [file...]
+//
+// Files are run once each, to replay crashes. Without them it runs random
+// code and mutated copies of a small ROM and reports iterations/s; --fresh
+// creates and destroys a console per iteration instead, for comparison.
+// --check (or NESEMU_FUZZ_CHECK set under libFuzzer) compares the state of
+// the power cycled console with that of a new one loading the same ROM, and
+// aborts if anything differs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "nes.h"
+#include "bench.h"
+
+#define HEADER_SIZE 	16
+#define PRG_SIZE 	0x8000
+#define CHR_SIZE 	0x2000
+#define IMAGE_SIZE 	(HEADER_SIZE + PRG_SIZE + CHR_SIZE)
+
+#define MODE_PRG 	0x01
+#define MODE_JIT 	0x10
+
+static nes_t* 	nes;
+static bool 	fresh;
+static bool 	check;
+static uint8_t 	image[IMAGE_SIZE];
+
+// NROM-256 with CHR-RAM, code from $8000 up, NMI, reset and IRQ at $8000
+static size_t wrap_prg(const uint8_t* code, size_t size)
+{
+	uint8_t* prg = image + HEADER_SIZE;
+
+	memset(image, 0, IMAGE_SIZE);
+	memcpy(image, "NES\x1A", 4);
+	image[4] = PRG_SIZE / 0x4000;
+
+	if (size > PRG_SIZE - 6)
+		size = PRG_SIZE - 6;
+
+	memcpy(prg, code, size);
+
+	for (int i = PRG_SIZE - 6; i < PRG_SIZE; i += 2)
+	{
+		prg[i] = 0x00;
+		prg[i + 1] = 0x80;
+	}
+
+	return HEADER_SIZE + PRG_SIZE;
+}
+
+// Power cycling has to leave nothing of the previous ROM behind
+static void check_power_cycle(const uint8_t* rom, size_t size)
+{
+	nes_t* reference = nes_create();
+	size_t state_size = nes_state_size();
+	uint8_t* expected = malloc(state_size);
+	uint8_t* actual = malloc(state_size);
+
+	if (reference == NULL || expected == NULL || actual == NULL
+	    || nes_load_rom_memory(reference, rom, size) != 0)
+	{
+		printf("Cannot create the reference console\n");
+		fflush(stdout);
+		abort();
+	}
+
+	nes_save_state(reference, expected, state_size);
+	nes_save_state(nes, actual, state_size);
+
+	for (size_t i = 0; i < state_size; i++)
+	{
+		if (expected[i] != actual[i])
+		{
+			printf("Power cycled state differs from a new console's at byte %zu (%02X, not %02X)\n",
+			       i, actual[i], expected[i]);
+			fflush(stdout);
+			abort();
+		}
+	}
+
+	free(actual);
+	free(expected);
+	nes_destroy(reference);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	if (size < 1)
+		return 0;
+
+	if (fresh && nes != NULL)
+	{
+		nes_destroy(nes);
+		nes = NULL;
+	}
+
+	if (nes == NULL)
+	{
+		nes_set_illegal_exit(0);
+		check |= getenv("NESEMU_FUZZ_CHECK") != NULL;
+		nes = nes_create();
+
+		if (nes == NULL)
+			return 0;
+	}
+
+	uint8_t mode = data[0];
+	int frames = ((mode >> 1) & 0x7) + 1;
+	const uint8_t* inputs = NULL;
+	const uint8_t* rom = data + 1;
+	size_t rom_size = size - 1;
+
+	data++;
+	size--;
+
+	nes_set_jit(nes, (mode & MODE_JIT) != 0);
+
+	if (mode & MODE_PRG)
+	{
+		size_t input_size = (size_t)frames * NES_PORTS;
+
+		if (size < input_size)
+			return 0;
+
+		inputs = data;
+		rom = image;
+		rom_size = wrap_prg(data + input_size, size - input_size);
+	}
+
+	if (nes_load_rom_memory(nes, rom, rom_size) != 0)
+		return 0;
+
+	nes_power_cycle(nes);
+
+	if (check)
+		check_power_cycle(rom, rom_size);
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (int port = 0; port < NES_PORTS; port++)
+			nes_set_input(nes, port, inputs ? inputs[frame * NES_PORTS + port] : 0x00);
+
+		nes_step_frame(nes);
+	}
+
+	return 0;
+}
+
+#ifdef FUZZ_MAIN
+
+static uint64_t random_state = 0x9E3779B97F4A7C15ull;
+
+// xorshift64, seeded the same every run so reports can be compared
+static uint32_t random_next()
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 7;
+	random_state ^= random_state << 17;
+
+	return (uint32_t)random_state;
+}
+
+static int replay(const char* filename)
+{
+	FILE* file = fopen(filename, "rb");
+
+	if (file == NULL)
+	{
+		printf("Cannot open %s\n", filename);
+		return 1;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	uint8_t* data = malloc(size > 0 ? size : 1);
+	int result = data == NULL || fread(data, 1, size, file) != (size_t)size;
+
+	if (result == 0)
+	{
+		LLVMFuzzerTestOneInput(data, size);
+		printf("%s: ok\n", filename);
+	}
+
+	free(data);
+	fclose(file);
+
+	return result;
+}
+
+// Half random code, half a well-formed NROM image with a few bytes changed
+static size_t generate(uint8_t* data)
+{
+	size_t size;
+
+	if (random_next() & 1)
+	{
+		size = 1 + NES_PORTS * 8 + random_next() % 4096;
+
+		for (size_t i = 0; i < size; i++)
+			data[i] = random_next();
+
+		data[0] |= MODE_PRG;
+	}
+	else
+	{
+		size = 1 + HEADER_SIZE + 0x4000 + CHR_SIZE;
+
+		memset(data, 0, size);
+		data[0] = random_next() & ~MODE_PRG;
+		memcpy(data + 1, "NES\x1A", 4);
+		data[1 + 4] = 1;
+		data[1 + 5] = 1;
+
+		// LDA $2002 / BPL, then whatever the mutations make of it
+		static const uint8_t wait[] = { 0xAD, 0x02, 0x20, 0x10, 0xFB, 0x4C, 0x00, 0xC0 };
+		memcpy(data + 1 + HEADER_SIZE, wait, sizeof(wait));
+		for (int i = 0x3FFB; i < 0x4000; i += 2)
+			data[1 + HEADER_SIZE + i] = 0xC0;
+
+		for (int i = random_next() % 16; i >= 0; i--)
+			data[1 + random_next() % (size - 1)] = random_next();
+
+		// and now and then cut short
+		if ((random_next() & 7) == 0)
+			size = 1 + random_next() % (size - 1);
+	}
+
+	return size;
+}
+
+int main(int argc, char* argv[])
+{
+	long iterations = 2000;
+	int files = 0;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+			iterations = atol(argv[++i]);
+		else if (strcmp(argv[i], "--fresh") == 0)
+			fresh = true;
+		else if (strcmp(argv[i], "--check") == 0)
+			check = true;
+		else if (replay(argv[i]) == 0)
+			files++;
+		else
+			return 1;
+	}
+
+	if (files > 0)
+		return 0;
+
+	static uint8_t data[1 + IMAGE_SIZE];
+	double start = seconds();
+
+	for (long i = 0; i < iterations; i++)
+		LLVMFuzzerTestOneInput(data, generate(data));
+
+	double elapsed = seconds() - start;
+
+	printf("%ld iterations in %.3fs (%.1f iterations/s)%s\n", iterations, elapsed,
+	       iterations / elapsed, fresh ? ", a new console each" : "");
+
+	nes_destroy(nes);
+
+	return 0;
+}
+
+#endif
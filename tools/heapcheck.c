@@ -0,0 +1,116 @@
+// Checks that running consoles does no heap traffic. The Makefile links the
+// core with --wrap for malloc, calloc, realloc, aligned_alloc and free, so
+// every call it makes lands in the wrappers below, which count them. Once
+// two consoles sharing the ROM are set up, one interpreting and one with the
+// JIT, they step the frames between them with input changing every frame;
+// then one is reset, one power cycled, and one saved and loaded into a
+// buffer made beforehand.
+//
+//   heapcheck <rom> [frames]
+//
+// Exits nonzero if any of that allocated or freed anything.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nes.h"
+
+void* 	__real_malloc(size_t size);
+void* 	__real_calloc(size_t count, size_t size);
+void* 	__real_realloc(void* block, size_t size);
+void* 	__real_aligned_alloc(size_t alignment, size_t size);
+void 	__real_free(void* block);
+
+static unsigned long 	allocations;
+static unsigned long 	frees;
+
+void* __wrap_malloc(size_t size)
+{
+	allocations++;
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+	allocations++;
+	return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* block, size_t size)
+{
+	allocations++;
+	return __real_realloc(block, size);
+}
+
+void* __wrap_aligned_alloc(size_t alignment, size_t size)
+{
+	allocations++;
+	return __real_aligned_alloc(alignment, size);
+}
+
+void __wrap_free(void* block)
+{
+	frees += block != NULL;
+	__real_free(block);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: heapcheck <rom> [frames]\n");
+		return 1;
+	}
+
+	int frames = argc > 2 ? atoi(argv[2]) : 10000;
+
+	nes_t* first = nes_create();
+
+	if (first == NULL || nes_load_rom(first, argv[1]) != 0)
+	{
+		printf("Cannot load %s\n", argv[1]);
+		return 1;
+	}
+
+	nes_t* second = nes_create_from(first);
+	size_t state_size = nes_state_size();
+	uint8_t* state = malloc(state_size);
+
+	if (second == NULL || state == NULL)
+	{
+		printf("Cannot create the consoles\n");
+		return 1;
+	}
+
+	// interpreted where there is no JIT
+	nes_set_jit(second, 1);
+
+	unsigned long created = allocations;
+	unsigned long freed = frees;
+
+	for (int frame = 0; frame < frames; frame++)
+	{
+		nes_t* nes = frame & 1 ? second : first;
+
+		nes_set_input(nes, 0, (uint8_t)(frame * 37));
+		nes_step_frame(nes);
+	}
+
+	nes_reset(first);
+	nes_power_cycle(second);
+	nes_save_state(first, state, state_size);
+	nes_load_state(first, state, state_size);
+	nes_step_frame(first);
+
+	unsigned long allocated = allocations - created;
+	freed = frees - freed;
+
+	printf("%d frames: %lu allocations, %lu frees (setting up took %lu allocations)\n",
+	       frames, allocated, freed, created);
+
+	free(state);
+	nes_destroy(second);
+	nes_destroy(first);
+
+	return allocated != 0 || freed != 0;
+}
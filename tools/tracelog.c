@@ -0,0 +1,76 @@
+// Decodes a binary trace written by --trace / nes_trace_dump() into
+// nestest.log style text on stdout:
+//
+//   C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7
+//
+// usage: tracelog <trace> [last N]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "disasm.h"
+
+static void print_record(const struct Trace_Record* r)
+{
+	char bytes[12] = "";
+	char text[40];
+	uint8_t length = disasm_length(r->bytes[0]);
+
+	for (uint8_t i = 0; i < length; i++)
+		sprintf(bytes + i * 3, "%02X ", r->bytes[i]);
+
+	disasm(text, sizeof(text), r->pc, r->bytes);
+
+	// unofficial opcodes push their '*' into the byte column
+	printf("%04X  %-9s%s%-31s A:%02X X:%02X Y:%02X P:%02X SP:%02X PPU:%3u,%3u CYC:%llu\n",
+		r->pc, bytes, text[0] == '*' ? "" : " ", text,
+		r->a, r->x, r->y, r->p, r->sp, r->scanline, r->dot, (unsigned long long)r->cycle);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		printf("usage: tracelog <trace> [last N]\n");
+		return 1;
+	}
+
+	FILE* stream = fopen(argv[1], "rb");
+
+	if (stream == NULL)
+	{
+		printf("Cannot open %s\n", argv[1]);
+		return 1;
+	}
+
+	struct Trace_Header header;
+
+	if (fread(&header, sizeof(header), 1, stream) != 1 || memcmp(header.id, TRACE_ID, 4) != 0 || header.version != TRACE_VERSION)
+	{
+		printf("%s is not a trace\n", argv[1]);
+		return 1;
+	}
+
+	uint64_t skip = 0;
+
+	if (argc > 2)
+	{
+		uint64_t last = strtoull(argv[2], NULL, 0);
+		skip = last < header.count ? header.count - last : 0;
+	}
+
+	fseek(stream, skip * sizeof(struct Trace_Record), SEEK_CUR);
+
+	struct Trace_Record records[4096];
+	size_t count;
+
+	while ((count = fread(records, sizeof(struct Trace_Record), 4096, stream)) > 0)
+		for (size_t i = 0; i < count; i++)
+			print_record(&records[i]);
+
+	fclose(stream);
+
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+#include "cpu.h"
+#include "ppu.h"
+#include "memory.h"
+#include "system.h"
+#include "disasm.h"
+
+CONSOLE_LOCAL struct Trace* 	trace;
+
+// Replaces any running trace. records is rounded up to a power of two.
+int trace_start(size_t records)
+{
+	size_t capacity = 1;
+
+	while (capacity < records)
+		capacity <<= 1;
+
+	trace_stop();
+
+	trace = malloc(sizeof(struct Trace));
+
+	if (trace == NULL)
+		return 1;
+
+	trace->records = malloc(capacity * sizeof(struct Trace_Record));
+
+	if (trace->records == NULL)
+	{
+		free(trace);
+		trace = NULL;
+		return 1;
+	}
+
+	trace->capacity = capacity;
+	trace->count = 0;
+
+	return 0;
+}
+
+void trace_stop()
+{
+	if (trace == NULL)
+		return;
+
+	free(trace->records);
+	free(trace);
+	trace = NULL;
+}
+
+// Reads instruction bytes without the side effects cpu_read() has on I/O.
+static inline uint8_t peek(uint16_t address)
+{
+	if (address >= 0x8000)
+		return prg_memory[address & 0x7FFF];
+	if (address <= 0x1FFF)
+		return cpu_memory[address];
+	return 0x00;
+}
+
+void trace_instruction(uint16_t pc)
+{
+	struct Trace_Record* record = &trace->records[trace->count++ & (trace->capacity - 1)];
+	uint8_t opcode = peek(pc);
+	uint8_t length = disasm_length(opcode);
+
+	record->cycle = cpu_cycle_count;
+	record->pc = pc;
+	record->scanline = ppu.scanline;
+	record->dot = ppu.cycle;
+	record->bytes[0] = opcode;
+	record->bytes[1] = length > 1 ? peek(pc + 1) : 0;
+	record->bytes[2] = length > 2 ? peek(pc + 2) : 0;
+	record->a = cpu.a;
+	record->x = cpu.x;
+	record->y = cpu.y;
+	record->p = cpu.p;
+	record->sp = cpu.sp;
+}
+
+// Writes the buffered records, oldest first, for tools/tracelog to decode.
+int trace_dump(const char* filename)
+{
+	if (trace == NULL)
+		return 1;
+
+	FILE* stream = fopen(filename, "wb");
+
+	if (stream == NULL)
+		return 1;
+
+	uint64_t count = trace->count < trace->capacity ? trace->count : trace->capacity;
+	uint64_t first = trace->count - count;
+
+	struct Trace_Header header = { .id = TRACE_ID, .version = TRACE_VERSION, .count = count };
+	fwrite(&header, sizeof(header), 1, stream);
+
+	size_t start = first & (trace->capacity - 1);
+	size_t head = count < trace->capacity - start ? count : trace->capacity - start;
+
+	fwrite(trace->records + start, sizeof(struct Trace_Record), head, stream);
+	fwrite(trace->records, sizeof(struct Trace_Record), count - head, stream);
+
+	return fclose(stream) != 0;
+}
@@ -0,0 +1,53 @@
+#include <stdint.h>
+#include <stddef.h>
+
+#include "console.h"
+
+#define TRACE_ID 	"NEST"
+#define TRACE_VERSION 	1
+
+// One executed instruction, captured before it runs (nestest convention).
+struct Trace_Record
+{
+	uint64_t	cycle;
+	uint16_t	pc;
+	uint16_t	scanline;
+	uint16_t	dot;
+	uint8_t		bytes[3];	// opcode and operands
+	uint8_t		a;
+	uint8_t		x;
+	uint8_t		y;
+	uint8_t		p;
+	uint8_t		sp;
+};
+
+// Last capacity instructions; count keeps going so the oldest is found by
+// wrapping. capacity is a power of two.
+struct Trace
+{
+	struct Trace_Record*	records;
+	size_t 			capacity;
+	uint64_t 		count;
+};
+
+struct Trace_Header
+{
+	char 		id[4];
+	uint32_t 	version;
+	uint64_t 	count;
+};
+
+extern CONSOLE_LOCAL struct Trace* 	trace;
+
+// Compiled in unless NESEMU_NO_TRACE; costs a pointer test per instruction
+// while no trace is running.
+#ifdef NESEMU_NO_TRACE
+#define TRACE_INSTRUCTION(pc)
+#else
+#define TRACE_INSTRUCTION(pc) if (trace != NULL) trace_instruction(pc)
+#endif
+
+int 	trace_start(size_t records);
+void 	trace_stop();
+void 	trace_instruction(uint16_t pc);
+int 	trace_dump(const char* filename);
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <SDL2/SDL.h>
 
@@ -6,13 +7,28 @@
 #include "ppu.h"
 
 graphics_t graphics;
-uint8_t *screen;
 
-void video_init()
+// Filters scale on the CPU into an XRGB8888 texture; without one the PPU's
+// RGB24 frame is uploaded as it is and the renderer stretches it.
+void video_init(enum filter filter)
 {
-	screen = malloc(WIDTH * HEIGHT * CHANNELS);
 	SDL_CreateWindowAndRenderer(WIDTH * SCALE, HEIGHT * SCALE, 0, &graphics.window, &graphics.renderer);
-	graphics.texture = SDL_CreateTexture(graphics.renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+
+	graphics.filter = filter;
+
+	if (filter != Filter_None)
+		graphics.filtered = malloc(WIDTH * HEIGHT * filters[filter].scale * filters[filter].scale * sizeof(uint32_t));
+
+	if (graphics.filtered == NULL)
+	{
+		graphics.filter = Filter_None;
+		graphics.texture = SDL_CreateTexture(graphics.renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STREAMING, WIDTH, HEIGHT);
+	}
+	else
+	{
+		graphics.texture = SDL_CreateTexture(graphics.renderer, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_STREAMING,
+						     WIDTH * filters[filter].scale, HEIGHT * filters[filter].scale);
+	}
 
 	SDL_SetWindowSize(graphics.window, WIDTH * SCALE, HEIGHT * SCALE);
 	SDL_SetWindowTitle(graphics.window, "NES");
@@ -20,7 +36,13 @@ void video_init()
 
 void video_display_frame()
 {
-	SDL_UpdateTexture(graphics.texture, NULL, screen, WIDTH * CHANNELS);
+	if (graphics.filter == Filter_None)
+		SDL_UpdateTexture(graphics.texture, NULL, screen, WIDTH * CHANNELS);
+	else
+	{
+		filter_apply(graphics.filter, screen, graphics.filtered);
+		SDL_UpdateTexture(graphics.texture, NULL, graphics.filtered, WIDTH * filters[graphics.filter].scale * sizeof(uint32_t));
+	}
 
 	SDL_RenderClear(graphics.renderer);
 	SDL_RenderCopy(graphics.renderer, graphics.texture, NULL, NULL);
@@ -1,11 +1,10 @@
 #include <SDL2/SDL.h>
 
-#define CHANNELS 3
-#define HEIGHT 240 
-#define WIDTH 256
+#include "filter.h"
+
 #define SCALE 4
 
-void video_init();
+void video_init(enum filter filter);
 void video_display_frame();
 
 typedef struct graphics_t
@@ -13,6 +12,6 @@ typedef struct graphics_t
 	SDL_Window* window;
 	SDL_Renderer* renderer;
 	SDL_Texture* texture;
+	enum filter filter;
+	uint32_t* filtered;	// the filter's output, unless Filter_None
 } graphics_t;
-
-extern uint8_t *screen;
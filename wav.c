@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "wav.h"
+
+// 16-bit mono PCM; the sizes are patched in once the length is known
+struct Wav_Header
+{
+	char		riff[4];
+	uint32_t	riff_size;
+	char		wave[4];
+	char		fmt[4];
+	uint32_t	fmt_size;
+	uint16_t	format;
+	uint16_t	channels;
+	uint32_t	sample_rate;
+	uint32_t	byte_rate;
+	uint16_t	block_align;
+	uint16_t	bits;
+	char		data[4];
+	uint32_t	data_size;
+};
+
+static FILE* 	wav_file;
+static uint32_t	wav_bytes;
+
+int wav_open(char* filename, uint32_t sample_rate)
+{
+	wav_file = fopen(filename, "wb");
+
+	if (wav_file == NULL)
+		return 1;
+
+	struct Wav_Header header = {
+		.riff = "RIFF", .wave = "WAVE", .fmt = "fmt ", .data = "data",
+		.fmt_size = 16, .format = 1, .channels = 1,
+		.sample_rate = sample_rate, .byte_rate = sample_rate * 2,
+		.block_align = 2, .bits = 16
+	};
+
+	fwrite(&header, sizeof(header), 1, wav_file);
+	wav_bytes = 0;
+
+	return 0;
+}
+
+void wav_write(const int16_t* samples, size_t count)
+{
+	if (wav_file == NULL)
+		return;
+
+	wav_bytes += fwrite(samples, sizeof(int16_t), count, wav_file) * sizeof(int16_t);
+}
+
+void wav_close()
+{
+	if (wav_file == NULL)
+		return;
+
+	uint32_t riff_size = sizeof(struct Wav_Header) - 8 + wav_bytes;
+
+	fseek(wav_file, offsetof(struct Wav_Header, riff_size), SEEK_SET);
+	fwrite(&riff_size, sizeof(riff_size), 1, wav_file);
+	fseek(wav_file, offsetof(struct Wav_Header, data_size), SEEK_SET);
+	fwrite(&wav_bytes, sizeof(wav_bytes), 1, wav_file);
+
+	fclose(wav_file);
+	wav_file = NULL;
+}
@@ -0,0 +1,6 @@
+#include <stdint.h>
+#include <stddef.h>
+
+int 	wav_open(char* filename, uint32_t sample_rate);
+void 	wav_write(const int16_t* samples, size_t count);
+void 	wav_close();